@@ -0,0 +1,109 @@
+:- module(bench_rolog, [bench_rolog/0]).
+
+% Benchmarks for the prolog pack
+%
+% Run with the CMake target bench, or
+%
+%    swipl -p library=prolog -g bench_rolog -t halt bench/bench_rolog.pl
+%
+% The results are written as CSV to the file given in ROLOG_BENCH_OUT (default:
+% standard output), one line per case and size, with the median wall time. 
+% Sizes range from 1 to 10^ROLOG_BENCH_MAX_EXP (default 7), each case is run 
+% ROLOG_BENCH_REPS times (default 5).
+
+:- use_module(library(rolog)).
+:- use_module(library(lists)).
+:- use_module(library(apply)).
+
+bench_rolog :-
+    env_number('ROLOG_BENCH_MAX_EXP', 7, MaxExp),
+    env_number('ROLOG_BENCH_REPS', 5, Reps),
+    (   getenv('ROLOG_BENCH_COMMIT', Commit)
+    ->  true
+    ;   Commit = unknown
+    ),
+    (   getenv('ROLOG_BENCH_OUT', File)
+    ->  setup_call_cleanup(open(File, write, Out),
+            bench_rolog(Out, Commit, MaxExp, Reps), close(Out))
+    ;   current_output(Out),
+        bench_rolog(Out, Commit, MaxExp, Reps)
+    ).
+
+bench_rolog(Out, Commit, MaxExp, Reps) :-
+    format(Out, "commit,case,size,reps,seconds~n", []),
+    forall(bench(MaxExp, Case, Size, Goal),
+        (   bench_case(Goal, Reps, Seconds),
+            format(Out, "~w,~w,~w,~w,~15f~n", [Commit, Case, Size, Reps, Seconds])
+        )).
+
+env_number(Name, Default, Value) :-
+    (   getenv(Name, Atom),
+        atom_number(Atom, Value)
+    ->  true
+    ;   Value = Default
+    ).
+
+% Median wall time of Reps runs
+bench_case(Goal, Reps, Seconds) :-
+    findall(T,
+        (   between(1, Reps, _),
+            garbage_collect,
+            get_time(T0),
+            once(Goal),
+            get_time(T1),
+            T is T1 - T0
+        ), Ts),
+    msort(Ts, Sorted),
+    length(Sorted, N),
+    Mid is N // 2,
+    nth0(Mid, Sorted, Seconds).
+
+size(MaxExp, Size) :-
+    between(0, MaxExp, Exp),
+    Size is 10^Exp.
+
+vector(real, N, V) :-
+    numlist(1, N, L),
+    maplist([I, F]>>(F is I + 0.5), L, Fs),
+    compound_name_arguments(V, ##, Fs).
+
+vector(integer, N, V) :-
+    numlist(1, N, L),
+    compound_name_arguments(V, '%%', L).
+
+vector(logical, N, V) :-
+    length(L, N),
+    maplist(=(true), L),
+    compound_name_arguments(V, '!!', L).
+
+vector(character, N, V) :-
+    length(L, N),
+    maplist(=("a"), L),
+    compound_name_arguments(V, $$, L).
+
+% pl2r: Prolog vector to R, R returns a scalar
+bench(MaxExp, Case, Size, r_eval(length(V), _)) :-
+    member(Type, [real, integer, logical, character]),
+    size(MaxExp, Size),
+    vector(Type, Size, V),
+    atom_concat(pl2r_, Type, Case).
+
+% r2pl: R returns vectors and matrices
+bench(MaxExp, Case, Size, r_eval(Expr, _)) :-
+    member(Type-Expr0, 
+      [ real-runif(Size),
+        integer-seq_len(Size),
+        logical-rep(true, Size),
+        character-rep("a", Size)
+      ]),
+    size(MaxExp, Size),
+    (   atom_concat(r2pl_, Type, Case),
+        Expr = Expr0
+    ;   atom_concat(r2pl_matrix_, Type, Case),
+        Rows is 10^(floor(log10(Size)) // 2),
+        Expr = matrix(Expr0, nrow=Rows)
+    ).
+
+% Round trips
+bench(_, r_eval_roundtrip, 10000, forall(between(1, 10000, _), r_eval(1 + 1, _))).
+bench(_, r_call_roundtrip, 10000, forall(between(1, 10000, _), r_call(identity(1)))).
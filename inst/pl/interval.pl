@@ -52,6 +52,12 @@ int(X, Res),
 int(X ... Y, Res)
  => interval(X ... Y, Res).
 
+% Vectors of lower and upper bounds, see native/1 below
+interval(A ... B, Res) :-
+    vector(A),
+    !,
+    Res = A ... B.
+
 % compatible with atoms like pi
 interval(A ... B, Res) :-
     !,
@@ -70,6 +76,38 @@ int(X =@= Y, Res)
     L =< U,
     Res = L ... U.
 
+%
+% Native kernel r_interval/4 of rolog for the basic operations on floats and
+% vectors ##(...) of floats. It uses the same cases as the clauses below and
+% rounds the bounds outwards. Integer bounds are handled by the clauses below.
+%
+interval(Expr, Res) :-
+    native(Expr),
+    !,
+    Expr =.. [Op, X, Y],
+    r_interval(Op, X, Y, Res0),
+    (   is_list(Res0)
+    ->  member(Res, Res0)
+    ;   Res = Res0
+    ).
+
+native(Expr) :-
+    Expr =.. [Op, A ... B, C ... D],
+    memberchk(Op, [+, -, *, /]),
+    maplist(native_bound, [A, B, C, D]),
+    predicate_property(r_interval(_, _, _, _), visible).
+
+native_bound(X) :-
+    float(X),
+    !.
+
+native_bound(X) :-
+    vector(X).
+
+vector(X) :-
+    compound(X),
+    compound_name_arity(X, '##', _).
+
 %
 % Hickey, Theorem 4
 %
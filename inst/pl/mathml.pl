@@ -1,5 +1,6 @@
 :- discontiguous test/0, math/4, current/3, paren/3, prec/3, type/3, denoting/3, ml/3.
 :- use_module(library(http/html_write)).
+:- use_module(library(prolog_wrap)).
 
 %
 % R interface
@@ -12,6 +13,16 @@ r2mathml(Flags, A, S) :-
     html(M, X, []),
     maplist(atom_string, X, S).
 
+% Render a list of expressions in a single query, one string per expression
+r2mathml_list(Flags, List, Strings) :-
+    maplist(r2mathml_string(Flags), List, Strings).
+
+r2mathml_string(Flags, A, S) :-
+    mathml(Flags, A, M),
+    html(M, X, []),
+    atomic_list_concat(X, Atom),
+    atom_string(Atom, S).
+
 mathml(Flags, A, X) :-
     ml(Flags, A, M),
     denoting(Flags, A, Denoting),
@@ -1197,3 +1208,53 @@ test(A) :-
     writeln(A),
     mathml([], A, M),
     html(math(M)).
+
+%
+% Memoization
+%
+% ml/3 and denoting/3 are wrapped, so that the recursive calls for the
+% subterms go through the cache as well. An edited expression only renders
+% the subterms along the changed path, the rest is found in the cache. The
+% key is the variant hash of the term and the flags. Terms that cannot be
+% hashed (e.g., attributed variables) are rendered without the cache.
+%
+% The cache is switched off with set_prolog_flag(mathml_cache, false) and
+% emptied with mathml_cache_clear/0, e.g., if the R functions behind
+% integrate/3 have been redefined.
+%
+:- create_prolog_flag(mathml_cache, true, [keep(true)]).
+:- dynamic mathml_memo/3.
+
+mathml_cache_limit(100000).
+
+mathml_cache_clear :-
+    retractall(mathml_memo(_, _, _)),
+    flag(mathml_memo, _, 0).
+
+memo(Name, Flags, A, X, Goal) :-
+    current_prolog_flag(mathml_cache, true),
+    catch(variant_sha1(Name-Flags-A, Key), _, fail),
+    !,
+    (   mathml_memo(Key, Name, X0)
+    ->  X = X0
+    ;   call(Goal),
+        memo_store(Key, Name, X)
+    ).
+
+memo(_Name, _Flags, _A, _X, Goal) :-
+    call(Goal).
+
+% Start over if the cache grows too large
+memo_store(Key, Name, X) :-
+    flag(mathml_memo, N, N + 1),
+    mathml_cache_limit(Limit),
+    (   N >= Limit
+    ->  mathml_cache_clear
+    ;   true
+    ),
+    assertz(mathml_memo(Key, Name, X)).
+
+:- wrap_predicate(ml(Flags, A, X), mathml_memo, Wrapped,
+       memo(ml, Flags, A, X, Wrapped)).
+:- wrap_predicate(denoting(Flags, A, X), mathml_memo, Wrapped,
+       memo(denoting, Flags, A, X, Wrapped)).
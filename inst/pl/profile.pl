@@ -0,0 +1,77 @@
+% Helpers for rolog_profile in R: run SWI-Prolog's profiler and return the
+% per-predicate counts as columns, which are translated to R vectors.
+:- use_module(library(statistics)).
+:- use_module(library(apply)).
+:- use_module(library(lists)).
+
+rolog_profile_start :-
+    reset_profiler,
+    profiler(_, true).
+
+rolog_profile_stop :-
+    profiler(_, false).
+
+% Nodes: [predicate-Ps, calls-Cs, redo-Rs, exit-Es, self-Ss, total-Ts], with
+% self and total (i.e., self plus callees) time in seconds
+%
+% Edges: [caller-Ps, callee-Qs, calls-Cs]
+rolog_profile_data(Nodes, Edges) :-
+    profile_data(Data),
+    get_dict(summary, Data, Summary),
+    get_dict(nodes, Data, List),
+    get_dict(ticks, Summary, Ticks),
+    get_dict(time, Summary, Time),
+    (   Ticks > 0
+    ->  Tick is Time / Ticks
+    ;   Tick = 0.0
+    ),
+    maplist(profile_node(Tick), List, Rows),
+    profile_columns([predicate, calls, redo, exit, self, total], Rows, Nodes),
+    foldl(profile_edges, List, Links, []),
+    profile_columns([caller, callee, calls], Links, Edges).
+
+profile_node(Tick, Node, row(Name, Calls, Redo, Exit, Self, Total)) :-
+    get_dict(predicate, Node, Pred),
+    get_dict(ncalls, Node, Calls),
+    get_dict(nredo, Node, Redo),
+    get_dict(exit, Node, Exit),
+    get_dict(ticks_self, Node, TicksSelf),
+    get_dict(ticks_siblings, Node, TicksSiblings),
+    profile_name(Pred, Name),
+    Self is TicksSelf * Tick,
+    Total is (TicksSelf + TicksSiblings) * Tick.
+
+% The callees are terms with the predicate as first and the number of calls
+% as fifth argument
+profile_edges(Node, Links, Tail) :-
+    get_dict(predicate, Node, Pred),
+    get_dict(callees, Node, Callees),
+    profile_name(Pred, Caller),
+    foldl(profile_edge(Caller), Callees, Links, Tail).
+
+profile_edge(Caller, Callee, [row(Caller, Name, Calls) | Tail], Tail) :-
+    arg(1, Callee, Pred),
+    compound(Pred),
+    !,
+    profile_name(Pred, Name),
+    (   arg(5, Callee, Calls)
+    ->  true
+    ;   Calls = 0
+    ).
+
+profile_edge(_Caller, _Callee, Tail, Tail).
+
+profile_name(user:Pred, Name) :-
+    !,
+    format(string(Name), "~q", [Pred]).
+
+profile_name(Pred, Name) :-
+    format(string(Name), "~q", [Pred]).
+
+profile_columns(Keys, Rows, Columns) :-
+    length(Keys, N),
+    numlist(1, N, Index),
+    maplist(profile_column(Rows), Keys, Index, Columns).
+
+profile_column(Rows, Key, I, Key-Column) :-
+    maplist(arg(I), Rows, Column).
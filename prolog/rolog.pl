@@ -1,8 +1,19 @@
 :-  module(rolog, 
     [
       r_init/0,
+      r_init/1,
       r_call/1,
       r_eval/2,
+      r_eval/3,
+      r_pool_eval/2,
+      r_stream/2,
+      r_stream/3,
+      r_vec/3,
+      r_vec/4,
+      r_interval/4,
+      rolog_statistics/1,
+      rolog_trace/1,
+      rolog_trace_write/1,
       op(600, xfy, ::),
       op(800, xfx, <-),
       op(800, fx, <-),
@@ -20,60 +31,68 @@
     ),
     use_foreign_library(foreign(rolog)).
 
-:-  use_module(library(terms)).
+:-  use_module(library(option)).
 
+% The rewrites of ::, =<, A[B], {} and # are done natively in the translation
+% to R (option rewrite in r_eval_options)
 r_call(Expr) :-
-    pl2r_(Expr, R),
-    with_mutex(rolog, r_eval_(R)).
+    with_rolog(r_eval_(Expr)).
+
+% Run the goal with the mutex rolog. If tracing is on (see rolog_trace/1),
+% the time spent waiting for the mutex is recorded as well.
+with_rolog(Goal) :-
+    r_trace_now_(T),
+    with_mutex(rolog, (r_trace_mutex_(T), Goal)).
+
 
 r_eval(X, Y) :-
-    pl2r_(X, R),
-    with_mutex(rolog, r_eval_(R, Y)).
-
-pl2r_('::'(Namespace, Compound), X)
- => term_string(Namespace, Ns),
-    compound_name_arguments(Compound, Name, Arguments),
-    pl2r_('do.call'($(getNamespace(Ns), Name), Arguments), X).
-
-pl2r_(A =< B, X)
- => pl2r_('<='(A, B), X).
-
-pl2r_(A[B], X)
- => pl2r_('['(A, B), X).
-
-pl2r_({}, X)
- => X = [].
- 
-pl2r_({A; B}, X)
- => pl2r_curly({A; B}, C),
-    S =.. [';' | C],
-    X = '{'(S).
-
-pl2r_({A}, X)
- => pl2r_(A, C),
-    X = '{'(C).
-
-pl2r_(Hash, X),
-    compound(Hash),
-    compound_name_arguments(Hash, #, Args)
- => compound_name_arguments(C, c, Args),
-    pl2r_(C, X).
-
-pl2r_(A, X),
-    compound(A)
- => mapargs(pl2r_, A, X).
-
-pl2r_(A, X)
- => A = X.
-    
-pl2r_curly({A; B}, X)
- => pl2r_(A, H),
-    pl2r_curly({B}, T),
-    X = [H | T].
-
-pl2r_curly({A}, X)
- => pl2r_(A, H),
-    X = [H].
+    with_rolog(r_eval_(X, Y)).
+
+% r_eval(+Expr, -Res, +Options)
+%
+% Same as r_eval/2, with options:
+%   transfer(T): default or fast. With fast, Expr is recorded with
+%   PL_record_external and decoded to R in one pass, and Res is written as
+%   prolog text and read with one call, see option transfer in R's
+%   rolog_options(). Terms that are not covered are translated as usual.
+r_eval(X, Y, Options) :-
+    option(transfer(T), Options, default),
+    must_be(oneof([default, fast]), T),
+    with_rolog(r_eval_(X, Y, T)).
+
+% r_pool_eval(+Expr, -Result)
+%
+% Evaluate Expr in an idle worker of the pool (see r_init/1). The workers are
+% separate R sessions, so that the state of the embedded R (e.g., variables
+% assigned with <-) is not visible there. The mutex is only needed for the
+% translation.
+r_pool_eval(X, Y) :-
+    r_pool_size_(N),
+    N > 0,
+    !,
+    setup_call_cleanup(r_pool_acquire_(W),
+      ( with_rolog(r_pool_send_(W, X)),
+        r_pool_wait_(W),
+        with_rolog(r_pool_receive_(W, X, Y))
+      ), r_pool_release_(W)).
+
+r_pool_eval(_, _) :-
+    existence_error(r_pool, workers).
+
+% r_stream(+Expr, -List) and r_stream(+Expr, -List, +Options)
+%
+% Evaluate Expr in the embedded R and return the resulting vector as a lazy
+% list. The elements are translated in chunks when the list is consumed, so
+% that long vectors are not on the stack as a whole.
+%
+% Options:
+%   chunk(K): number of elements per chunk (default 10000)
+r_stream(Expr, List) :-
+    r_stream(Expr, List, []).
+
+r_stream(Expr, List, Options) :-
+    option(chunk(K), Options, 10000),
+    with_rolog(r_stream_(Expr, K, List)).
 
 <-(Expr) :-
     r_call(Expr).
@@ -105,3 +124,25 @@ r_init :-
 
 r_init :-
     r_init_.
+
+% r_init(+Options)
+%
+% Options:
+%   workers(N): start N R processes with Rscript for r_pool_eval/2 (default
+%     0). The workers are fresh R sessions, r_eval/2, r_call/1 and <- still
+%     go to the embedded R. Not on Windows.
+%   buffer(Bytes): size of the shared-memory ring buffers for the messages
+%     to and from each worker (default 1 MB). Larger messages are streamed.
+r_init(Options) :-
+    r_init,
+    option(workers(N), Options, 0),
+    option(buffer(Size), Options, 1048576),
+    (   N > 0
+    ->  r_eval('R.home'("bin"), Bin),
+        directory_file_path(Bin, 'Rscript', Rscript),
+        absolute_file_name(foreign(rolog), Lib,
+          [file_type(executable), access(read)]),
+        r_pool_init_(N, Size, Rscript, Lib),
+        at_halt(r_pool_done_)
+    ;   true
+    ).
@@ -1,10 +1,11 @@
-:-  module(rs_rolog, 
+:-  module(rs_rolog,
     [
       rs_init/1,
       rs_call/2,
       rs_eval/3,
       rs_submit/3,
       rs_close/1,
+      rs_load/2,
       rx_call/1,
       rx_eval/2,
       rx_submit/2
@@ -12,14 +13,47 @@
 
 :-  reexport(library(rolog)).
 :-  use_module(library(broadcast)).
+:-  use_module(library(socket)).
+:-  use_module(library(readutil)).
 :-  use_module(library(http/http_session)).
 
-:-  dynamic rs_session/1.
+% Session pool
+%
+% rs_session(Session, Queue): Rserve session with a message queue for the
+%   jobs that wait for the session
+% rs_busy(Session, Alias, Expr): job running on the session
+% rs_listener(Socket, Port): local socket of the collector
+%
+% A job is evaluated in its session as tryCatch(Expr, finally=Notify), where
+% Notify connects to the socket of the collector and sends the name of the
+% session. A single collector thread blocks in tcp_accept/3, so that it does
+% not hold the rolog mutex while the jobs run. The mutex is only taken to
+% fetch the result with RS.collect, which is ready at this point, and to start
+% the next job of the session. The sessions must therefore run on the same
+% host.
+%
+% While jobs are queued for a session, the session stays busy: the next job
+% is started before the finished one is retracted. rs_close/1 waits for
+% this, so that queued jobs are not lost.
+
+:-  dynamic rs_session/2.
+:-  dynamic rs_busy/3.
+:-  dynamic rs_listener/2.
+
+% Tell the collector that the job of the session is done
+notify_function("function(port, token) { \
+    con <- socketConnection(port=port, open='w', blocking=TRUE) ; \
+    on.exit(close(con)) ; \
+    writeLines(token, con) }").
 
 rs_init(Session) :-
     <- library('RSclient'),
     Session <- 'RS.connect'(),
-    assert(rs_session(Session)).
+    notify_function(F),
+    <- 'RS.eval'(Session, rs_rolog_notify <- eval(parse(text=F)), wait=true),
+    message_queue_create(Queue),
+    assert(rs_session(Session, Queue)),
+    with_mutex(rs_rolog, rs_collector).
 
 rs_call(Session, Expr) :-
     idle(Session),
@@ -29,38 +63,112 @@ rs_eval(Session, Expr, Result) :-
     idle(Session),
     Result <- 'RS.eval'(Session, Expr, wait=true).
 
+% Start the job if the session is idle, otherwise append it to the queue of
+% the session
 rs_submit(Session, Alias, Expr) :-
-    idle(Session),
-    assert(lock(Session)),
-    <- 'RS.eval'(Session, Expr, wait=false),
-    thread_create(rs_collect(Session, Alias, Expr), _).
-
-rs_collect(Session, Alias, Expr) :-
-    Result <- 'RS.collect'(Session, timeout=0),
-    (   Result = [] % check if this is "null"
-     -> sleep(0.1),
-        rs_collect(Session, Alias, Expr)
-     ; 	retract(lock(Session)),
-	broadcast(rs_result(Session, Alias, Expr, Result))
+    with_mutex(rs_rolog, rs_dispatch(Session, Alias, Expr)).
+
+rs_dispatch(Session, _, _) :-
+    \+ rs_session(Session, _),
+    !,
+    existence_error(rs_session, Session).
+
+rs_dispatch(Session, Alias, Expr) :-
+    \+ rs_busy(Session, _, _),
+    !,
+    rs_start(Session, Alias, Expr).
+
+rs_dispatch(Session, Alias, Expr) :-
+    rs_session(Session, Queue),
+    thread_send_message(Queue, job(Alias, Expr)).
+
+rs_start(Session, Alias, Expr) :-
+    rs_listener(_, Port),
+    atom_string(Session, Token),
+    <- 'RS.eval'(Session, tryCatch(Expr, finally=rs_rolog_notify(Port, Token)),
+         wait=false),
+    assert(rs_busy(Session, Alias, Expr)).
+
+% Start the next job from the queue of the session. A job that cannot be
+% started is reported as an error result.
+rs_next(Session) :-
+    rs_session(Session, Queue),
+    thread_get_message(Queue, job(Alias, Expr), [timeout(0)]),
+    !,
+    catch(rs_start(Session, Alias, Expr), E,
+      ( broadcast(rs_result(Session, Alias, Expr, error(E))),
+        rs_next(Session) )).
+
+rs_next(_).
+
+% Number of running and waiting jobs
+rs_load(Session, Load) :-
+    rs_session(Session, Queue),
+    message_queue_property(Queue, size(Waiting)),
+    (   rs_busy(Session, _, _)
+    ->  Load is Waiting + 1
+    ;   Load = Waiting
     ).
 
+rs_collector :-
+    rs_listener(_, _),
+    !.
+
+rs_collector :-
+    tcp_socket(Socket),
+    tcp_setopt(Socket, reuseaddr),
+    tcp_bind(Socket, localhost:Port),
+    tcp_listen(Socket, 5),
+    assert(rs_listener(Socket, Port)),
+    thread_create(rs_collect(Socket), _, [alias(rs_collector), detached(true)]).
+
+rs_collect(Socket) :-
+    tcp_accept(Socket, Client, _Peer),
+    setup_call_cleanup(tcp_open_socket(Client, Stream),
+        read_line_to_string(Stream, Token),
+        close(Stream)),
+    catch(rs_collected(Token), E, print_message(error, E)),
+    rs_collect(Socket).
+
+% The result is ready, RS.collect returns at once
+rs_collected(Token) :-
+    atom_string(Session, Token),
+    rs_busy(Session, Alias, Expr),
+    !,
+    catch(Value <- 'RS.collect'(Session), E, Value = error(E)),
+    with_mutex(rs_rolog,
+      ( rs_next(Session),
+        retract(rs_busy(Session, Alias, Expr)) )),
+    broadcast(rs_result(Session, Alias, Expr, Value)).
+
+rs_collected(_).
+
+% Wait until the running and queued jobs of the session are done
 rs_close(Session) :-
-    <- 'RS.close'(Session),
-    retract(Session).
+    idle(Session),
+    with_mutex(rs_rolog, rs_close_idle(Session)),
+    !.
+
+rs_close(Session) :-
+    rs_close(Session).
 
-:- dynamic lock/1.
+rs_close_idle(Session) :-
+    \+ rs_busy(Session, _, _),
+    <- 'RS.close'(Session),
+    retract(rs_session(Session, Queue)),
+    message_queue_destroy(Queue).
 
 idle(Session) :-
-    \+ lock(Session),
+    \+ rs_busy(Session, _, _),
     !.
 
 idle(Session) :-
-    thread_wait(\+ lock(Session), [wait_preds([-(lock/1)])]).
+    thread_wait(\+ rs_busy(Session, _, _), [wait_preds([-(rs_busy/3)])]).
 
 % if a session is found, use session
 rx_call(Expr) :-
     http_in_session(Session),
-    rs_session(Session),
+    rs_session(Session, _),
     !,
     rs_call(Session, Expr).
 
@@ -70,7 +178,7 @@ rx_call(Expr) :-
 
 rx_eval(Expr, Result) :-
     http_in_session(Session),
-    rs_session(Session),
+    rs_session(Session, _),
     !,
     rs_eval(Session, Expr, Result).
 
@@ -79,12 +187,19 @@ rx_eval(Expr, Result) :-
 
 rx_submit(Alias, Expr) :-
     http_in_session(Session),
-    rs_session(Session),
+    rs_session(Session, _),
+    !,
+    rs_submit(Session, Alias, Expr).
+
+% otherwise, submit to the least loaded session of the pool
+rx_submit(Alias, Expr) :-
+    aggregate_all(min(Load, Session),
+        ( rs_session(Session, _), rs_load(Session, Load) ), min(_, Session)),
     !,
     rs_submit(Session, Alias, Expr).
 
 rx_submit(_, _) :-
-    resource_error(http_session).
+    resource_error(rs_session).
 
 test :-
     rs_init(s1),
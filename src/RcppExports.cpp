@@ -34,12 +34,13 @@ BEGIN_RCPP
 END_RCPP
 }
 // submit_
-RObject submit_();
-RcppExport SEXP _rolog_submit_() {
+RObject submit_(RObject select);
+RcppExport SEXP _rolog_submit_(SEXP selectSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    rcpp_result_gen = Rcpp::wrap(submit_());
+    Rcpp::traits::input_parameter< RObject >::type select(selectSEXP);
+    rcpp_result_gen = Rcpp::wrap(submit_(select));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -80,8 +81,119 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// save_db_
+LogicalVector save_db_(String fname, CharacterVector predicates);
+RcppExport SEXP _rolog_save_db_(SEXP fnameSEXP, SEXP predicatesSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< String >::type fname(fnameSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type predicates(predicatesSEXP);
+    rcpp_result_gen = Rcpp::wrap(save_db_(fname, predicates));
+    return rcpp_result_gen;
+END_RCPP
+}
+// load_db_
+LogicalVector load_db_(String fname);
+RcppExport SEXP _rolog_load_db_(SEXP fnameSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< String >::type fname(fnameSEXP);
+    rcpp_result_gen = Rcpp::wrap(load_db_(fname));
+    return rcpp_result_gen;
+END_RCPP
+}
+// materialize_
+List materialize_(RObject query, CharacterVector dynamic, List aoptions);
+RcppExport SEXP _rolog_materialize_(SEXP querySEXP, SEXP dynamicSEXP, SEXP aoptionsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< RObject >::type query(querySEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type dynamic(dynamicSEXP);
+    Rcpp::traits::input_parameter< List >::type aoptions(aoptionsSEXP);
+    rcpp_result_gen = Rcpp::wrap(materialize_(query, dynamic, aoptions));
+    return rcpp_result_gen;
+END_RCPP
+}
+// refresh_
+List refresh_(String name, CharacterVector names, List aoptions);
+RcppExport SEXP _rolog_refresh_(SEXP nameSEXP, SEXP namesSEXP, SEXP aoptionsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< String >::type name(nameSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type names(namesSEXP);
+    Rcpp::traits::input_parameter< List >::type aoptions(aoptionsSEXP);
+    rcpp_result_gen = Rcpp::wrap(refresh_(name, names, aoptions));
+    return rcpp_result_gen;
+END_RCPP
+}
+// query_async_
+List query_async_(RObject query, List aoptions);
+RcppExport SEXP _rolog_query_async_(SEXP querySEXP, SEXP aoptionsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< RObject >::type query(querySEXP);
+    Rcpp::traits::input_parameter< List >::type aoptions(aoptionsSEXP);
+    rcpp_result_gen = Rcpp::wrap(query_async_(query, aoptions));
+    return rcpp_result_gen;
+END_RCPP
+}
+// poll_
+List poll_(int id);
+RcppExport SEXP _rolog_poll_(SEXP idSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< int >::type id(idSEXP);
+    rcpp_result_gen = Rcpp::wrap(poll_(id));
+    return rcpp_result_gen;
+END_RCPP
+}
+// collect_
+List collect_(int id, bool wait, List aoptions);
+RcppExport SEXP _rolog_collect_(SEXP idSEXP, SEXP waitSEXP, SEXP aoptionsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< int >::type id(idSEXP);
+    Rcpp::traits::input_parameter< bool >::type wait(waitSEXP);
+    Rcpp::traits::input_parameter< List >::type aoptions(aoptionsSEXP);
+    rcpp_result_gen = Rcpp::wrap(collect_(id, wait, aoptions));
+    return rcpp_result_gen;
+END_RCPP
+}
+// cancel_
+LogicalVector cancel_(int id);
+RcppExport SEXP _rolog_cancel_(SEXP idSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< int >::type id(idSEXP);
+    rcpp_result_gen = Rcpp::wrap(cancel_(id));
+    return rcpp_result_gen;
+END_RCPP
+}
+// codec_
+LogicalVector codec_(String rclass, String functor, int arity, Function encode, Function decode);
+RcppExport SEXP _rolog_codec_(SEXP rclassSEXP, SEXP functorSEXP, SEXP aritySEXP, SEXP encodeSEXP, SEXP decodeSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< String >::type rclass(rclassSEXP);
+    Rcpp::traits::input_parameter< String >::type functor(functorSEXP);
+    Rcpp::traits::input_parameter< int >::type arity(aritySEXP);
+    Rcpp::traits::input_parameter< Function >::type encode(encodeSEXP);
+    Rcpp::traits::input_parameter< Function >::type decode(decodeSEXP);
+    rcpp_result_gen = Rcpp::wrap(codec_(rclass, functor, arity, encode, decode));
+    return rcpp_result_gen;
+END_RCPP
+}
 // portray_
-RObject portray_(RObject query, List options);
+CharacterVector portray_(RObject query, List options);
 RcppExport SEXP _rolog_portray_(SEXP querySEXP, SEXP optionsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
@@ -92,6 +204,52 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// portray_lazy_
+RObject portray_lazy_(RObject query, List options);
+RcppExport SEXP _rolog_portray_lazy_(SEXP querySEXP, SEXP optionsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< RObject >::type query(querySEXP);
+    Rcpp::traits::input_parameter< List >::type options(optionsSEXP);
+    rcpp_result_gen = Rcpp::wrap(portray_lazy_(query, options));
+    return rcpp_result_gen;
+END_RCPP
+}
+// stats_
+List stats_(bool reset);
+RcppExport SEXP _rolog_stats_(SEXP resetSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< bool >::type reset(resetSEXP);
+    rcpp_result_gen = Rcpp::wrap(stats_(reset));
+    return rcpp_result_gen;
+END_RCPP
+}
+// trace_
+LogicalVector trace_(bool on, int size);
+RcppExport SEXP _rolog_trace_(SEXP onSEXP, SEXP sizeSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< bool >::type on(onSEXP);
+    Rcpp::traits::input_parameter< int >::type size(sizeSEXP);
+    rcpp_result_gen = Rcpp::wrap(trace_(on, size));
+    return rcpp_result_gen;
+END_RCPP
+}
+// trace_write_
+double trace_write_(String fname);
+RcppExport SEXP _rolog_trace_write_(SEXP fnameSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< String >::type fname(fnameSEXP);
+    rcpp_result_gen = Rcpp::wrap(trace_write_(fname));
+    return rcpp_result_gen;
+END_RCPP
+}
 // call_
 RObject call_(String query);
 RcppExport SEXP _rolog_call_(SEXP querySEXP) {
@@ -104,13 +262,14 @@ BEGIN_RCPP
 END_RCPP
 }
 // init_
-LogicalVector init_(String argv0);
-RcppExport SEXP _rolog_init_(SEXP argv0SEXP) {
+LogicalVector init_(String argv0, String state);
+RcppExport SEXP _rolog_init_(SEXP argv0SEXP, SEXP stateSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< String >::type argv0(argv0SEXP);
-    rcpp_result_gen = Rcpp::wrap(init_(argv0));
+    Rcpp::traits::input_parameter< String >::type state(stateSEXP);
+    rcpp_result_gen = Rcpp::wrap(init_(argv0, state));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -128,18 +287,37 @@ END_RCPP
 static const R_CallMethodDef CallEntries[] = {
     {"_rolog_query_", (DL_FUNC) &_rolog_query_, 3},
     {"_rolog_clear_", (DL_FUNC) &_rolog_clear_, 0},
-    {"_rolog_submit_", (DL_FUNC) &_rolog_submit_, 0},
+    {"_rolog_submit_", (DL_FUNC) &_rolog_submit_, 1},
     {"_rolog_once_", (DL_FUNC) &_rolog_once_, 3},
     {"_rolog_findall_", (DL_FUNC) &_rolog_findall_, 3},
     {"_rolog_consult_", (DL_FUNC) &_rolog_consult_, 1},
+    {"_rolog_save_db_", (DL_FUNC) &_rolog_save_db_, 2},
+    {"_rolog_load_db_", (DL_FUNC) &_rolog_load_db_, 1},
+    {"_rolog_materialize_", (DL_FUNC) &_rolog_materialize_, 3},
+    {"_rolog_refresh_", (DL_FUNC) &_rolog_refresh_, 3},
+    {"_rolog_query_async_", (DL_FUNC) &_rolog_query_async_, 2},
+    {"_rolog_poll_", (DL_FUNC) &_rolog_poll_, 1},
+    {"_rolog_collect_", (DL_FUNC) &_rolog_collect_, 3},
+    {"_rolog_cancel_", (DL_FUNC) &_rolog_cancel_, 1},
+    {"_rolog_codec_", (DL_FUNC) &_rolog_codec_, 5},
     {"_rolog_portray_", (DL_FUNC) &_rolog_portray_, 2},
+    {"_rolog_portray_lazy_", (DL_FUNC) &_rolog_portray_lazy_, 2},
+    {"_rolog_stats_", (DL_FUNC) &_rolog_stats_, 1},
+    {"_rolog_trace_", (DL_FUNC) &_rolog_trace_, 2},
+    {"_rolog_trace_write_", (DL_FUNC) &_rolog_trace_write_, 1},
     {"_rolog_call_", (DL_FUNC) &_rolog_call_, 1},
-    {"_rolog_init_", (DL_FUNC) &_rolog_init_, 1},
+    {"_rolog_init_", (DL_FUNC) &_rolog_init_, 2},
     {"_rolog_done_", (DL_FUNC) &_rolog_done_, 0},
     {NULL, NULL, 0}
 };
 
+void codec_init(DllInfo* dll);
+void portray_init(DllInfo* dll);
+void bindings_init(DllInfo* dll);
 RcppExport void R_init_rolog(DllInfo *dll) {
     R_registerRoutines(dll, NULL, CallEntries, NULL, NULL);
     R_useDynamicSymbols(dll, FALSE);
+    codec_init(dll);
+    portray_init(dll);
+    bindings_init(dll);
 }
@@ -3,6 +3,19 @@
 #include <SWI-cpp2.h>
 #include <SWI-cpp2.cpp>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
 using namespace Rcpp ;
 
 // Translate prolog expression to R
@@ -47,6 +60,560 @@ RObject pl2r(PlTerm pl, CharacterVector& names, PlTerm& vars, List options) ;
 //
 PlTerm r2pl(SEXP r, CharacterVector& names, PlTerm& vars, List options) ;
 
+// Codecs for R classes like factor or Date, see below
+bool r2pl_codec(SEXP r, PlTerm& pl, CharacterVector& names, PlTerm& vars, List options) ;
+bool pl2r_codec(PlTerm pl, RObject& r, CharacterVector& names, PlTerm& vars, List options) ;
+
+// Lazy list for long R vectors, see r_stream
+PlTerm r2pl_stream(SEXP r, int64_t chunk, List options) ;
+
+// Performance counters
+//
+// The counters are always on and can be read from R (rolog_stats) and from
+// Prolog (rolog_statistics/1). They are updated with relaxed atomics because
+// in the prolog pack, several threads may call r_eval at the same time.
+//
+struct RlCounter
+{
+  std::atomic<unsigned long long> n ;
+  std::atomic<unsigned long long> ns ;
+
+  void add(unsigned long long dt)
+  {
+    n.fetch_add(1, std::memory_order_relaxed) ;
+    ns.fetch_add(dt, std::memory_order_relaxed) ;
+  }
+
+  void reset()
+  {
+    n = 0 ;
+    ns = 0 ;
+  }
+} ;
+
+// Kinds of terms for r2pl and pl2r
+enum RlKind 
+{ 
+  KIND_NULL, KIND_REAL, KIND_INTEGER, KIND_LOGICAL, KIND_STRING, KIND_ATOM, 
+  KIND_VARIABLE, KIND_LIST, KIND_COMPOUND, KIND_FUNCTION, KIND_OTHER, KIND_N
+} ;
+
+static const char* kind_names[KIND_N] = 
+{
+  "null", "real", "integer", "logical", "string", "atom", 
+  "variable", "list", "compound", "function", "other"
+} ;
+
+// Latency histogram with buckets for < 1 us, < 2 us, < 4 us, ... 
+static const int HIST_N = 32 ;
+
+struct RlStats
+{
+  RlCounter r2pl[KIND_N] ;
+  RlCounter pl2r[KIND_N] ;
+  RlCounter open ;
+  RlCounter next ;
+  RlCounter close ;
+  std::atomic<unsigned long long> solutions ;
+  std::atomic<unsigned long long> max_solutions ;
+  std::atomic<unsigned long long> inferences ;
+  std::atomic<unsigned long long> max_inferences ;
+  std::atomic<unsigned long long> max_stack ;
+  RlCounter r_eval ;
+  std::atomic<unsigned long long> r_eval_hist[HIST_N] ;
+
+  void reset()
+  {
+    for(int i=0 ; i<KIND_N ; i++)
+    {
+      r2pl[i].reset() ;
+      pl2r[i].reset() ;
+    }
+
+    open.reset() ;
+    next.reset() ;
+    close.reset() ;
+    solutions = 0 ;
+    max_solutions = 0 ;
+    inferences = 0 ;
+    max_inferences = 0 ;
+    max_stack = 0 ;
+    r_eval.reset() ;
+    for(int i=0 ; i<HIST_N ; i++)
+      r_eval_hist[i] = 0 ;
+  }
+} ;
+
+static RlStats rolog_stats ;
+
+// Update high-water mark
+static void atomic_max(std::atomic<unsigned long long>& m, unsigned long long x)
+{
+  unsigned long long old = m.load(std::memory_order_relaxed) ;
+  while(x > old && !m.compare_exchange_weak(old, x, std::memory_order_relaxed)) ;
+}
+
+// Counters may exceed the range of long on some systems
+static PlTerm pl_count(unsigned long long x)
+{
+  PlTerm_var pl ;
+  PlCheckFail(PL_put_int64(pl.C_, (int64_t) x)) ;
+  return pl ;
+}
+
+// Measure the time from construction to destruction and add it to a counter
+class RlTimer
+{
+  RlCounter& counter ;
+  std::chrono::steady_clock::time_point t0 ;
+
+public:
+  RlTimer(RlCounter& acounter)
+    : counter(acounter), 
+      t0(std::chrono::steady_clock::now())
+  {
+  }
+
+  unsigned long long elapsed() const
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - t0).count() ;
+  }
+
+  ~RlTimer()
+  {
+    counter.add(elapsed()) ;
+  }
+} ;
+
+// Count conversions of a given kind. Only the outermost call of the recursive
+// r2pl and pl2r is timed, so that nested terms are not counted twice. The
+// nested calls are counted in thread-local variables, which are added to the
+// shared counters when the outermost call is done.
+class RlConversion
+{
+  RlCounter& counter ;
+  unsigned long long& count ;
+  bool outer ;
+  std::chrono::steady_clock::time_point t0 ;
+  static thread_local int depth ;
+  static thread_local unsigned long long pending[2][KIND_N] ;
+
+  static void flush()
+  {
+    for(int k=0 ; k<KIND_N ; k++)
+    {
+      if(pending[0][k])
+        rolog_stats.r2pl[k].n.fetch_add(pending[0][k], std::memory_order_relaxed) ;
+      if(pending[1][k])
+        rolog_stats.pl2r[k].n.fetch_add(pending[1][k], std::memory_order_relaxed) ;
+      pending[0][k] = pending[1][k] = 0 ;
+    }
+  }
+
+public:
+  // counters is rolog_stats.r2pl or rolog_stats.pl2r
+  RlConversion(RlCounter* counters, RlKind kind)
+    : counter(counters[kind]),
+      count(pending[counters == rolog_stats.pl2r][kind]),
+      outer(depth++ == 0)
+  {
+    if(outer)
+      t0 = std::chrono::steady_clock::now() ;
+  }
+
+  ~RlConversion()
+  {
+    depth-- ;
+    count++ ;
+    if(outer)
+    {
+      counter.ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - t0).count(), std::memory_order_relaxed) ;
+      flush() ;
+    }
+  }
+} ;
+
+thread_local int RlConversion::depth = 0 ;
+thread_local unsigned long long RlConversion::pending[2][KIND_N] = { } ;
+
+// Same as RlTimer, also adding the latency of r_eval to the histogram
+class RlEvalTimer : public RlTimer
+{
+public:
+  RlEvalTimer()
+    : RlTimer(rolog_stats.r_eval)
+  {
+  }
+
+  ~RlEvalTimer()
+  {
+    int b = 0 ;
+    for(unsigned long long us = elapsed() / 1000 ; us > 0 && b < HIST_N-1 ; us >>= 1)
+      b++ ;
+    rolog_stats.r_eval_hist[b].fetch_add(1, std::memory_order_relaxed) ;
+  }
+} ;
+
+// Tracing
+//
+// Opt-in spans for the queries from R (open, next solution, bindings, close)
+// and the calls from prolog to R (translation, evaluation, translation back,
+// waiting for the mutex in the pack). See rolog_trace in R and rolog_trace/1
+// in prolog. Each thread appends to its own ring buffer without locks, the
+// oldest spans are overwritten. The buffers are collected when the trace is
+// written in Chrome's trace event format, also while other threads record.
+//
+// The slots are published with a sequence number (seqlock): it is odd while
+// the slot is written, and 2*(i+1) when span i is complete. The reader skips
+// slots whose number changed or does not belong to the span it expects. A
+// ring is only replaced by its own thread under trace_mutex, which the
+// writer holds as well.
+struct RlSpan
+{
+  std::atomic<unsigned long long> seq ;
+  std::atomic<const char*> name ;
+  std::atomic<const char*> cat ;
+  std::atomic<long long> t0 ; // ns since trace_origin
+  std::atomic<long long> dt ;
+} ;
+
+struct RlTraceBuffer
+{
+  std::unique_ptr<RlSpan[]> ring ;
+  size_t size ;
+  std::atomic<unsigned long long> head ;
+  std::atomic<unsigned long> generation ;
+  int tid ;
+} ;
+
+static std::atomic<bool> trace_on(false) ;
+static std::atomic<unsigned long> trace_generation(0) ;
+static std::atomic<size_t> trace_size(65536) ;
+static const std::chrono::steady_clock::time_point trace_origin = std::chrono::steady_clock::now() ;
+
+// Registration of new threads and writing the trace. The buffers are never
+// freed, because the threads keep a pointer to them.
+static std::mutex trace_mutex ;
+static std::vector<std::unique_ptr<RlTraceBuffer>> trace_buffers ;
+
+static long long trace_now()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - trace_origin).count() ;
+}
+
+// Buffer of the calling thread, emptied when tracing has been restarted
+static RlTraceBuffer* trace_thread_buffer()
+{
+  static thread_local RlTraceBuffer* buf = NULL ;
+  unsigned long g = trace_generation.load(std::memory_order_acquire) ;
+  if(buf == NULL)
+  {
+    std::lock_guard<std::mutex> lock(trace_mutex) ;
+    trace_buffers.emplace_back(new RlTraceBuffer()) ;
+    buf = trace_buffers.back().get() ;
+    buf->size = 0 ;
+    buf->head = 0 ;
+    buf->generation = g - 1 ;
+    int tid = PL_thread_self() ;
+    buf->tid = tid > 0 ? tid : 1000 + (int) trace_buffers.size() ;
+  }
+
+  if(buf->generation.load(std::memory_order_relaxed) != g)
+  {
+    std::lock_guard<std::mutex> lock(trace_mutex) ;
+    size_t size = trace_size.load() ;
+    buf->ring.reset(size ? new RlSpan[size]() : NULL) ;
+    buf->size = size ;
+    buf->head.store(0, std::memory_order_release) ;
+    buf->generation.store(g, std::memory_order_release) ;
+  }
+
+  return buf ;
+}
+
+static void trace_span(const char* name, const char* cat, long long t0, long long t1)
+{
+  RlTraceBuffer* b = trace_thread_buffer() ;
+  if(b->size == 0)
+    return ;
+
+  unsigned long long h = b->head.load(std::memory_order_relaxed) ;
+  RlSpan& s = b->ring[h % b->size] ;
+  s.seq.store(2*h + 1, std::memory_order_relaxed) ;
+  std::atomic_thread_fence(std::memory_order_release) ;
+  s.name.store(name, std::memory_order_relaxed) ;
+  s.cat.store(cat, std::memory_order_relaxed) ;
+  s.t0.store(t0, std::memory_order_relaxed) ;
+  s.dt.store(t1 - t0, std::memory_order_relaxed) ;
+  s.seq.store(2*h + 2, std::memory_order_release) ;
+  b->head.store(h + 1, std::memory_order_release) ;
+}
+
+// Record the time from construction to destruction (or stop)
+class RlSpanTimer
+{
+  const char* name ;
+  const char* cat ;
+  bool on ;
+  long long t0 ;
+
+public:
+  RlSpanTimer(const char* aname, const char* acat)
+    : name(aname),
+      cat(acat),
+      on(trace_on.load(std::memory_order_relaxed)),
+      t0(on ? trace_now() : 0)
+  {
+  }
+
+  void stop()
+  {
+    if(on)
+      trace_span(name, cat, t0, trace_now()) ;
+    on = false ;
+  }
+
+  ~RlSpanTimer()
+  {
+    stop() ;
+  }
+} ;
+
+// Start tracing with the given number of spans per thread, or stop it
+static void trace_enable(bool on, size_t size)
+{
+  if(on)
+  {
+    trace_size = size ;
+    trace_generation.fetch_add(1, std::memory_order_acq_rel) ;
+  }
+
+  trace_on = on ;
+}
+
+// Write the spans of all threads to a JSON file that can be loaded into
+// chrome://tracing or Perfetto. Returns the number of spans, or -1 if the
+// file cannot be opened.
+static long trace_write(const char* fname)
+{
+  std::lock_guard<std::mutex> lock(trace_mutex) ;
+  FILE* f = fopen(fname, "w") ;
+  if(f == NULL)
+    return -1 ;
+
+  unsigned long g = trace_generation.load(std::memory_order_acquire) ;
+  long n = 0 ;
+  bool first = true ;
+  fprintf(f, "{\"traceEvents\":[") ;
+  for(auto& b : trace_buffers)
+  {
+    if(b->generation.load(std::memory_order_acquire) != g || b->size == 0)
+      continue ;
+
+    fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+      "\"args\":{\"name\":\"thread %d\"}}", first ? "" : ",", b->tid, b->tid) ;
+    first = false ;
+
+    unsigned long long h = b->head.load(std::memory_order_acquire) ;
+    unsigned long long size = b->size ;
+    for(unsigned long long i = h > size ? h - size : 0 ; i<h ; i++)
+    {
+      // Copy the span, skip it if it has been overwritten in the meantime
+      const RlSpan& s = b->ring[i % size] ;
+      unsigned long long seq = s.seq.load(std::memory_order_acquire) ;
+      const char* name = s.name.load(std::memory_order_relaxed) ;
+      const char* cat = s.cat.load(std::memory_order_relaxed) ;
+      long long t0 = s.t0.load(std::memory_order_relaxed) ;
+      long long dt = s.dt.load(std::memory_order_relaxed) ;
+      std::atomic_thread_fence(std::memory_order_acquire) ;
+      if(seq != 2*i + 2 || s.seq.load(std::memory_order_relaxed) != seq)
+        continue ;
+
+      fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+        "\"ts\":%.3f,\"dur\":%.3f}", name, cat, b->tid, t0 / 1e3, dt / 1e3) ;
+      n++ ;
+    }
+  }
+
+  fprintf(f, "\n],\"displayTimeUnit\":\"ns\"}\n") ;
+  fclose(f) ;
+  return n ;
+}
+
+// Read an integer from statistics/2, e.g., inferences or stack
+static unsigned long long pl_statistics(const char* key)
+{
+  PlFrame f ;
+  PlTerm_var v ;
+  int64_t i = 0 ;
+  if(!PlCall("statistics", PlTermv(PlTerm_atom(key), v)) || !PL_get_int64(v.C_, &i))
+    return 0 ;
+
+  return (unsigned long long) i ;
+}
+
+// Report the statistics to prolog as a list
+//
+// r2pl(Kind, Count, Seconds) and pl2r(...) for all kinds of terms
+// query(open/next/close, Count, Seconds)
+// solutions(Total, Max), inferences(Total, Max), stack(Max)
+// r_eval(Count, Seconds, Histogram), with Histogram the number of calls that
+//   took less than 1, 2, 4, ... microseconds
+//
+PlTerm rolog_statistics()
+{
+  PlTerm_var pl ;
+  PlTerm_tail tail(pl) ;
+  for(int i=0 ; i<KIND_N ; i++)
+  {
+    PlCheckFail(tail.append(PlCompound("r2pl", PlTermv(PlTerm_atom(kind_names[i]),
+      pl_count(rolog_stats.r2pl[i].n.load()), PlTerm_float(rolog_stats.r2pl[i].ns.load() / 1e9))))) ;
+    PlCheckFail(tail.append(PlCompound("pl2r", PlTermv(PlTerm_atom(kind_names[i]),
+      pl_count(rolog_stats.pl2r[i].n.load()), PlTerm_float(rolog_stats.pl2r[i].ns.load() / 1e9))))) ;
+  }
+
+  PlCheckFail(tail.append(PlCompound("query", PlTermv(PlTerm_atom("open"),
+    pl_count(rolog_stats.open.n.load()), PlTerm_float(rolog_stats.open.ns.load() / 1e9))))) ;
+  PlCheckFail(tail.append(PlCompound("query", PlTermv(PlTerm_atom("next"),
+    pl_count(rolog_stats.next.n.load()), PlTerm_float(rolog_stats.next.ns.load() / 1e9))))) ;
+  PlCheckFail(tail.append(PlCompound("query", PlTermv(PlTerm_atom("close"),
+    pl_count(rolog_stats.close.n.load()), PlTerm_float(rolog_stats.close.ns.load() / 1e9))))) ;
+  PlCheckFail(tail.append(PlCompound("solutions", PlTermv(
+    pl_count(rolog_stats.solutions.load()), pl_count(rolog_stats.max_solutions.load()))))) ;
+  PlCheckFail(tail.append(PlCompound("inferences", PlTermv(
+    pl_count(rolog_stats.inferences.load()), pl_count(rolog_stats.max_inferences.load()))))) ;
+  PlCheckFail(tail.append(PlCompound("stack", PlTermv(pl_count(rolog_stats.max_stack.load()))))) ;
+
+  PlTerm_var hist ;
+  PlTerm_tail htail(hist) ;
+  for(int i=0 ; i<HIST_N ; i++)
+    PlCheckFail(htail.append(pl_count(rolog_stats.r_eval_hist[i].load()))) ;
+  PlCheckFail(htail.close()) ;
+  PlCheckFail(tail.append(PlCompound("r_eval", PlTermv(pl_count(rolog_stats.r_eval.n.load()),
+    PlTerm_float(rolog_stats.r_eval.ns.load() / 1e9), hist)))) ;
+
+  PlCheckFail(tail.close()) ;
+  return pl ;
+}
+
+// Statistics for prolog. rolog_statistics(reset) clears the counters.
+PREDICATE(rolog_statistics, 1)
+{
+  if(A1.is_atom() && A1.as_string() == "reset")
+  {
+    rolog_stats.reset() ;
+    return true ;
+  }
+
+  return A1.unify_term(rolog_statistics()) ;
+}
+
+// rolog_trace(+Mode): on, off, or size(N) to start with a ring buffer of N
+// spans per thread
+PREDICATE(rolog_trace, 1)
+{
+  if(A1.is_atom() && A1.as_string() == "on")
+  {
+    trace_enable(true, 65536) ;
+    return true ;
+  }
+
+  if(A1.is_atom() && A1.as_string() == "off")
+  {
+    trace_enable(false, 0) ;
+    return true ;
+  }
+
+  if(A1.is_compound() && A1.name().as_string() == "size" && A1.arity() == 1)
+  {
+    int64_t n ;
+    PlCheckFail(PL_get_int64_ex(A1[1].C_, &n)) ;
+    if(n > 0)
+    {
+      trace_enable(true, (size_t) n) ;
+      return true ;
+    }
+  }
+
+  return PL_domain_error("trace_mode", A1.C_) ;
+}
+
+// rolog_trace_write(+File): write the trace in Chrome's trace event format
+PREDICATE(rolog_trace_write, 1)
+{
+  std::string fname = A1.as_string(PlEncoding::Locale) ;
+  if(trace_write(fname.c_str()) < 0)
+    return PL_permission_error("open", "source_sink", A1.C_) ;
+
+  return true ;
+}
+
+// Logical option that may be missing, e.g., in the options for r_eval
+bool option_true(List& options, const char* name)
+{
+  if(!options.containsElementNamed(name))
+    return false ;
+
+  LogicalVector v = as<LogicalVector>(options[name]) ;
+  return v.size() && v(0) == TRUE ;
+}
+
+// Options for expressions that are evaluated by R (r_eval). These are
+// translated without codecs, so that, e.g., factor(V, L) calls R's factor().
+List eval_options(List options)
+{
+  if(!option_true(options, "codecs"))
+    return options ;
+
+  List o = clone(options) ;
+  o("codecs") = false ;
+  return o ;
+}
+
+// Numeric option for limits (e.g., timeout). Missing, NULL, NA, infinite and
+// non-positive values mean that there is no limit, which is returned as 0.
+double option_limit(List& options, const char* name)
+{
+  if(!options.containsElementNamed(name) || Rf_isNull(options[name]))
+    return 0 ;
+
+  NumericVector v = as<NumericVector>(options[name]) ;
+  if(v.size() == 0 || !R_FINITE(v(0)) || v(0) <= 0)
+    return 0 ;
+
+  return v(0) ;
+}
+
+// Rename functors with the table in option functors, e.g., R's <= to prolog's
+// =<. With reverse = true, prolog's names are translated back to R. This 
+// replaces the R-level preproc and postproc hooks.
+const char* rename_functor(const char* name, List& options, bool reverse=false)
+{
+  if(!options.containsElementNamed("functors"))
+    return name ;
+
+  SEXP table = options["functors"] ;
+  if(TYPEOF(table) != STRSXP)
+    return name ;
+
+  SEXP from = Rf_getAttrib(table, R_NamesSymbol) ;
+  if(TYPEOF(from) != STRSXP)
+    return name ;
+
+  SEXP to = table ;
+  if(reverse)
+    std::swap(from, to) ;
+
+  for(R_xlen_t i=0 ; i<XLENGTH(table) ; i++)
+    if(!strcmp(CHAR(STRING_ELT(from, i)), name))
+      return CHAR(STRING_ELT(to, i)) ;
+
+  return name ;
+}
+
 // Prolog -> R
 RObject pl2r_null()
 {
@@ -245,6 +812,8 @@ RObject pl2r_symbol(PlTerm pl)
 
 // Forward declaration, needed below
 RObject pl2r_compound(PlTerm pl, CharacterVector& names, PlTerm& vars, List options) ;
+RObject pl2r_call(const char* name, PlTerm pl, CharacterVector& names, PlTerm& vars, List options) ;
+bool pl2r_rewrite(PlTerm pl, RObject& r, CharacterVector& names, PlTerm& vars, List options) ;
 
 // Convert prolog neck to R function
 RObject pl2r_function(PlTerm pl, CharacterVector& names, PlTerm& vars, List options)
@@ -277,7 +846,9 @@ RObject pl2r_function(PlTerm pl, CharacterVector& names, PlTerm& vars, List opti
     head.push_back(Named(arg.as_string(PlEncoding::UTF8)) = Function("substitute")()) ;
   }
 
-  RObject body = pl2r_compound(plbody, names, vars, options) ;
+  RObject body ;
+  if(!plbody.is_compound() || !pl2r_rewrite(plbody, body, names, vars, options))
+    body = pl2r_compound(plbody, names, vars, options) ;
   head.push_back(body) ;
 
   Function as_function("as.function") ;
@@ -415,7 +986,15 @@ RObject pl2r_compound(PlTerm pl, CharacterVector& names, PlTerm& vars, List opti
     return pl2r_function(pl, names, vars, options) ;
 
   // Other compounds
-  Language r(pl.name().as_string(PlEncoding::UTF8).c_str()) ;
+  std::string name = pl.name().as_string(PlEncoding::UTF8) ;
+  return pl2r_call(rename_functor(name.c_str(), options, true), pl, names, vars, options) ;
+}
+
+// Translate the arguments of a prolog compound to an R call with the given
+// name
+RObject pl2r_call(const char* name, PlTerm pl, CharacterVector& names, PlTerm& vars, List options)
+{
+  Language r(name) ;
   for(unsigned int i=1 ; i<=pl.arity() ; i++)
   {
     PlTerm arg = pl[i] ;
@@ -441,16 +1020,58 @@ RObject pl2r_compound(PlTerm pl, CharacterVector& names, PlTerm& vars, List opti
 
 // Translate prolog list to R list
 //
-// This code allows for lists like [1, 2 | Tail] with variable tail. These 
-// cannot be processed by PlTerm_tail, therefore, the code is a bit more 
-// complicated, also because it can handle named arguments.
+// Proper lists are walked once, the R list is allocated in advance, and the
+// names are added when the first pair a-X is found. The term references are
+// released after each element. Lists like [1, 2 | Tail] with variable (or
+// other) tail are handled by pl2r_partial below.
 //
 // Examples:
 // [1, 2, 3] -> list(1, 2, 3)
 // [1, 2 | X] -> `[|]`(1, `[|]`(2, expression(X)))
 // [a-1, b-2, c-3] -> list(a=1, b=2, c=3)
 //
+RObject pl2r_partial(PlTerm pl, CharacterVector& names, PlTerm& vars, List options) ;
+
 RObject pl2r_list(PlTerm pl, CharacterVector& names, PlTerm& vars, List options)
+{
+  size_t len ;
+  if(PL_skip_list(pl.C_, 0, &len) != PL_LIST)
+    return pl2r_partial(pl, names, vars, options) ;
+
+  static functor_t minus = PL_new_functor(PL_new_atom("-"), 2) ;
+  List r(len) ;
+  CharacterVector n ;
+  term_t tail = PL_copy_term_ref(pl.C_) ;
+  term_t head = PL_new_term_ref() ;
+  term_t key = PL_new_term_ref() ;
+  term_t value = PL_new_term_ref() ;
+  for(size_t i=0 ; PL_get_list(tail, head, tail) ; i++)
+  {
+    term_t mark = PL_new_term_ref() ;
+
+    // convert prolog pair a-X to named list element
+    atom_t a ;
+    if(PL_is_functor(head, minus) && PL_get_arg(1, head, key) && PL_get_atom(key, &a))
+    {
+      PlCheckFail(PL_get_arg(2, head, value)) ;
+      if(n.length() == 0)
+        n = CharacterVector(len) ;
+      n(i) = PlAtom(a).as_string(PlEncoding::UTF8) ;
+      r(i) = pl2r(PlTerm(value), names, vars, options) ;
+    }
+    else
+      r(i) = pl2r(PlTerm(head), names, vars, options) ; // element has no name
+
+    PL_reset_term_refs(mark) ;
+  }
+
+  if(n.length())
+    r.names() = n ;
+
+  return r ;
+}
+
+RObject pl2r_partial(PlTerm pl, CharacterVector& names, PlTerm& vars, List options)
 {
   PlTerm head = pl[1] ;
   
@@ -499,41 +1120,248 @@ RObject pl2r_list(PlTerm pl, CharacterVector& names, PlTerm& vars, List options)
   return as<RObject>(r) ;
 }
 
-RObject pl2r(PlTerm pl, CharacterVector& names, PlTerm& vars, List options)
+// Translate SWI-Prolog dict to named R list, e.g., _{a:1, b:2} -> list(a=1,
+// b=2). The elements are in the standard order of the keys, the tag is
+// dropped.
+//
+// The pairs are collected with PL_for_dict instead of calling dict_pairs/3.
+// The translation is done afterwards, so that R errors do not unwind through
+// PL_for_dict.
+static int pl2r_dict_pair(term_t key, term_t value, int last, void* closure)
 {
-  if(pl.type() == PL_NIL)
-    return pl2r_null() ;
-  
-  if(pl.is_integer())
-    return pl2r_integer(pl) ;
-  
-  if(pl.is_float())
-    return pl2r_real(pl) ;
-  
-  if(pl.is_string())
-    return pl2r_char(pl) ;
-  
-  if(pl.is_atom())
-    return pl2r_symbol(pl) ;
-  
-  if(pl.is_list())
-    return pl2r_list(pl, names, vars, options) ;
-  
-  if(pl.is_compound())
-    return pl2r_compound(pl, names, vars, options) ;
-  
-  if(pl.is_variable())
-    return pl2r_variable(pl, names, vars) ;
-  
-  stop("pl2r: Cannot convert %s", pl.as_string(PlEncoding::Locale).c_str()) ;
+  std::vector<std::pair<term_t, term_t> >* kv = static_cast<std::vector<std::pair<term_t, term_t> >*>(closure) ;
+  kv->push_back(std::make_pair(PL_copy_term_ref(key), PL_copy_term_ref(value))) ;
+  return 0 ;
 }
 
-// Translate R expression to prolog
-//
-// Forward declarations
-PlTerm r2pl_real(NumericVector r, List options) ;
-PlTerm r2pl_logical(LogicalVector r, List options) ;
-PlTerm r2pl_integer(IntegerVector r, List options) ;
+RObject pl2r_dict(PlTerm pl, CharacterVector& names, PlTerm& vars, List options)
+{
+  std::vector<std::pair<term_t, term_t> > kv ;
+  if(PL_for_dict(pl.C_, pl2r_dict_pair, &kv, DICT_SORTED) != 0)
+    stop("pl2r: Cannot convert dict %s", pl.as_string(PlEncoding::Locale).c_str()) ;
+
+  List r(kv.size()) ;
+  CharacterVector n(kv.size()) ;
+  for(size_t i=0 ; i<kv.size() ; i++)
+  {
+    PlTerm key(kv[i].first) ;
+    n(i) = key.is_atom() ? key.name().as_string(PlEncoding::UTF8) : key.as_string(PlEncoding::UTF8) ;
+    r(i) = pl2r(PlTerm(kv[i].second), names, vars, options) ;
+  }
+
+  r.names() = n ;
+  return r ;
+}
+
+// Native rewrites of prolog compounds, see option rewrite. This replaces the
+// predicate pl2r_/2 of the prolog pack that walked and copied the whole term
+// once more before the translation. Each rule returns false if it does not
+// apply, then the compound is translated as usual.
+typedef bool (*RlRewrite)(PlTerm pl, RObject& r, CharacterVector& names, PlTerm& vars, List options) ;
+
+struct RlRewriteRule
+{
+  const char* name ;
+  int arity ; // -1 for any arity
+  RlRewrite rewrite ;
+  atom_t atom ;
+} ;
+
+// Ns::f(a, b) -> do.call(getNamespace("Ns")$f, list(a, b))
+bool rewrite_namespace(PlTerm pl, RObject& r, CharacterVector& names, PlTerm& vars, List options)
+{
+  PlTerm ns = pl[1] ;
+  PlTerm f = pl[2] ;
+  if(!f.is_atom() && !f.is_compound())
+    return false ;
+
+  size_t arity = f.is_compound() ? f.arity() : 0 ;
+  List args(arity) ;
+  CharacterVector n(arity) ;
+  bool named = false ;
+  for(size_t i=0 ; i<arity ; i++)
+  {
+    PlTerm arg = f[i+1] ;
+
+    // a-1 and a=1 are translated to named arguments
+    std::string op = arg.is_compound() && arg.arity() == 2 ? arg.name().as_string(PlEncoding::UTF8) : "" ;
+    if((op == "-" || op == "=") && arg[1].is_atom())
+    {
+      n(i) = arg[1].name().as_string(PlEncoding::UTF8) ;
+      args(i) = pl2r(arg[2], names, vars, options) ;
+      named = true ;
+      continue ;
+    }
+
+    args(i) = pl2r(arg, names, vars, options) ;
+  }
+
+  if(named)
+    args.names() = n ;
+
+  Language getns("getNamespace", ns.as_string(PlEncoding::UTF8)) ;
+  Language fn("$", getns, Symbol(f.name().as_string(PlEncoding::UTF8))) ;
+  r = Language("do.call", fn, args) ;
+  return true ;
+}
+
+// A =< B -> A <= B
+bool rewrite_le(PlTerm pl, RObject& r, CharacterVector& names, PlTerm& vars, List options)
+{
+  r = pl2r_call("<=", pl, names, vars, options) ;
+  return true ;
+}
+
+// #(1, 2, 3) -> c(1, 2, 3)
+bool rewrite_hash(PlTerm pl, RObject& r, CharacterVector& names, PlTerm& vars, List options)
+{
+  r = pl2r_call("c", pl, names, vars, options) ;
+  return true ;
+}
+
+// A[B] -> `[`(A, B). The block term A[B] is '[]'([B], A) in SWI-Prolog.
+bool rewrite_block(PlTerm pl, RObject& r, CharacterVector& names, PlTerm& vars, List options)
+{
+  PlTerm index = pl[1] ;
+  if(!index.is_list() || index[2].type() != PL_NIL)
+    return false ;
+
+  r = Language("[", pl2r(pl[2], names, vars, options), pl2r(index[1], names, vars, options)) ;
+  return true ;
+}
+
+// {A} -> `{`(A), and {A; B; C} -> `{`(`;`(A, B, C))
+bool rewrite_curly(PlTerm pl, RObject& r, CharacterVector& names, PlTerm& vars, List options)
+{
+  PlTerm a = pl[1] ;
+  if(!a.is_compound() || a.arity() != 2 || a.name().as_string() != ";")
+  {
+    r = Language("{", pl2r(a, names, vars, options)) ;
+    return true ;
+  }
+
+  static functor_t semicolon = PL_new_functor(PL_new_atom(";"), 2) ;
+  term_t t = PL_copy_term_ref(a.C_) ;
+  term_t h = PL_new_term_ref() ;
+  Language s(";") ;
+  while(PL_is_functor(t, semicolon))
+  {
+    PlCheckFail(PL_get_arg(1, t, h) && PL_get_arg(2, t, t)) ;
+    s.push_back(pl2r(PlTerm(h), names, vars, options)) ;
+  }
+
+  s.push_back(pl2r(PlTerm(t), names, vars, options)) ;
+  r = Language("{", s) ;
+  return true ;
+}
+
+static RlRewriteRule rewrite_rules[] =
+{
+  { "::", 2, rewrite_namespace, 0 },
+  { "=<", 2, rewrite_le, 0 },
+  { "[]", 2, rewrite_block, 0 },
+  { "{}", 1, rewrite_curly, 0 },
+  { "#", -1, rewrite_hash, 0 }
+} ;
+
+bool pl2r_rewrite(PlTerm pl, RObject& r, CharacterVector& names, PlTerm& vars, List options)
+{
+  if(!option_true(options, "rewrite"))
+    return false ;
+
+  atom_t name ;
+  size_t arity ;
+  if(!PL_get_name_arity(pl.C_, &name, &arity))
+    return false ;
+
+  for(RlRewriteRule& rule : rewrite_rules)
+  {
+    if(!rule.atom)
+      rule.atom = PL_new_atom(rule.name) ;
+
+    if(rule.atom == name && (rule.arity < 0 || (size_t) rule.arity == arity))
+      return rule.rewrite(pl, r, names, vars, options) ;
+  }
+
+  return false ;
+}
+
+// Kind of prolog term, for the statistics
+RlKind pl2r_kind(PlTerm pl)
+{
+  switch(pl.type())
+  {
+    case PL_NIL: return KIND_NULL ;
+    case PL_INTEGER: return KIND_INTEGER ;
+    case PL_FLOAT: return KIND_REAL ;
+    case PL_STRING: return KIND_STRING ;
+    case PL_ATOM: return KIND_ATOM ;
+    case PL_LIST_PAIR: return KIND_LIST ;
+    case PL_DICT: return KIND_LIST ;
+    case PL_TERM: return KIND_COMPOUND ;
+    case PL_VARIABLE: return KIND_VARIABLE ;
+  }
+
+  return KIND_OTHER ;
+}
+
+RObject pl2r(PlTerm pl, CharacterVector& names, PlTerm& vars, List options)
+{
+  RlConversion c(rolog_stats.pl2r, pl2r_kind(pl)) ;
+
+  if(pl.type() == PL_NIL)
+    return pl2r_null() ;
+  
+  if(pl.is_integer())
+    return pl2r_integer(pl) ;
+  
+  if(pl.is_float())
+    return pl2r_real(pl) ;
+  
+  if(pl.is_string())
+    return pl2r_char(pl) ;
+  
+  if(pl.is_atom())
+  {
+    // {} -> NULL, see option rewrite
+    static atom_t curly = PL_new_atom("{}") ;
+    atom_t a ;
+    if(PL_get_atom(pl.C_, &a) && a == curly && option_true(options, "rewrite"))
+      return pl2r_null() ;
+
+    return pl2r_symbol(pl) ;
+  }
+  
+  if(pl.is_list())
+    return pl2r_list(pl, names, vars, options) ;
+  
+  if(PL_is_dict(pl.C_))
+    return pl2r_dict(pl, names, vars, options) ;
+
+  if(pl.is_compound())
+  {
+    RObject r ;
+    if(pl2r_rewrite(pl, r, names, vars, options))
+      return r ;
+
+    if(pl2r_codec(pl, r, names, vars, options))
+      return r ;
+
+    return pl2r_compound(pl, names, vars, options) ;
+  }
+  
+  if(pl.is_variable())
+    return pl2r_variable(pl, names, vars) ;
+  
+  stop("pl2r: Cannot convert %s", pl.as_string(PlEncoding::Locale).c_str()) ;
+}
+
+// Translate R expression to prolog
+//
+// Forward declarations
+PlTerm r2pl_real(NumericVector r, List options) ;
+PlTerm r2pl_logical(LogicalVector r, List options) ;
+PlTerm r2pl_integer(IntegerVector r, List options) ;
 PlTerm r2pl_string(CharacterVector r, List options) ;
 
 // This returns an empty list
@@ -701,11 +1529,8 @@ PlTerm r2pl_integer(IntegerVector r, List options)
 // variables, and it is unified with it if the name is found. Otherwise, a new
 // variable is created.
 //
-PlTerm r2pl_var(ExpressionVector r, CharacterVector& names, PlTerm& vars, List options)
+PlTerm r2pl_varname(Symbol n, CharacterVector& names, PlTerm& vars, List options)
 {
-  // Variable name in R
-  Symbol n = as<Symbol>(r[0]) ;
-  
   // If the variable should be "atomized" for pretty printing
   if(as<LogicalVector>(options("atomize"))(0))
     return PlTerm_atom(n.c_str()) ; // TODO: 
@@ -731,9 +1556,26 @@ PlTerm r2pl_var(ExpressionVector r, CharacterVector& names, PlTerm& vars, List o
   return pl ;
 }
 
+PlTerm r2pl_var(ExpressionVector r, CharacterVector& names, PlTerm& vars, List options)
+{
+  // Variable name in R
+  return r2pl_varname(as<Symbol>(r[0]), names, vars, options) ;
+}
+
 // Translate R symbol to prolog atom
-PlTerm r2pl_atom(Symbol r)
+//
+// With the option simplified (see as.rolog), symbols like .X are translated 
+// to variables, and the single dot is the anonymous variable.
+PlTerm r2pl_atom(Symbol r, CharacterVector& names, PlTerm& vars, List options)
 {
+  if(r.c_str()[0] == '.' && option_true(options, "simplified"))
+  {
+    if(r.c_str()[1] == 0)
+      return r2pl_varname(Symbol("_"), names, vars, options) ;
+
+    return r2pl_varname(Symbol(r.c_str() + 1), names, vars, options) ;
+  }
+
   return PlTerm_atom(r.c_str()) ;
 }
 
@@ -784,10 +1626,54 @@ PlTerm r2pl_string(CharacterVector r, List options)
   return PlCompound((const char*) options("charvec"), args) ;
 }
 
+// Forward declaration, needed below
+PlTerm r2pl_list(List r, CharacterVector& names, PlTerm& vars, List options) ;
+
+// Simplified syntax (see as.rolog): (a) is evaluated, ""[1, 2] and list(1, 2)
+// are lists
+bool r2pl_simplified(Language r, PlTerm& pl, CharacterVector& names, PlTerm& vars, List options)
+{
+  if(TYPEOF(CAR(r)) != SYMSXP || !option_true(options, "simplified"))
+    return false ;
+
+  const char* head = CHAR(PRINTNAME(CAR(r))) ;
+  if(!strcmp(head, "(") && CDR(r) != R_NilValue)
+  {
+    SEXP arg = CADR(r) ;
+    if(TYPEOF(arg) == SYMSXP)
+      PlCheckFail(pl.unify_term(r2pl(Rcpp_eval(arg, Environment::global_env()), names, vars, options))) ;
+    else
+      PlCheckFail(pl.unify_term(r2pl(arg, names, vars, options))) ;
+    return true ;
+  }
+
+  if(!strcmp(head, "[") && CDR(r) != R_NilValue && TYPEOF(CADR(r)) == STRSXP
+     && XLENGTH(CADR(r)) == 1 && !strcmp(CHAR(STRING_ELT(CADR(r), 0)), ""))
+  {
+    PlCheckFail(pl.unify_term(r2pl_list(as<List>(CDDR(r)), names, vars, options))) ;
+    return true ;
+  }
+
+  if(!strcmp(head, "list"))
+  {
+    PlCheckFail(pl.unify_term(r2pl_list(as<List>(CDR(r)), names, vars, options))) ;
+    return true ;
+  }
+
+  return false ;
+}
+
 // Translate R call to prolog compound, taking into account the names of the
 // arguments, e.g., rexp(50, rate=1) -> rexp(50, =(rate, 1))
 PlTerm r2pl_compound(Language r, CharacterVector& names, PlTerm& vars, List options)
 {
+  PlTerm_var simplified ;
+  if(r2pl_simplified(r, simplified, names, vars, options))
+    return simplified ;
+
+  // Functor, renamed according to option functors
+  const char* functor = rename_functor(as<Symbol>(CAR(r)).c_str(), options) ;
+
   // For convenience, collect arguments in a list
   List l = as<List>(CDR(r)) ;
 
@@ -796,7 +1682,7 @@ PlTerm r2pl_compound(Language r, CharacterVector& names, PlTerm& vars, List opti
   if(len == 0)
   {
     PlTermv pl(3) ;
-    PlCheckFail(pl[1].unify_atom(as<Symbol>(CAR(r)).c_str())) ;
+    PlCheckFail(pl[1].unify_atom(functor)) ;
     PlCheckFail(pl[2].unify_integer(0)) ;
     PlCall("compound_name_arity", pl) ;
     return pl[0] ;
@@ -820,7 +1706,95 @@ PlTerm r2pl_compound(Language r, CharacterVector& names, PlTerm& vars, List opti
       PlCheckFail(pl[i].unify_term(arg)) ; // no name
   }
 
-  return PlCompound(as<Symbol>(CAR(r)).c_str(), pl) ;
+  return PlCompound(functor, pl) ;
+}
+
+// Named lists are translated to dicts if all names are given and unique
+bool r2pl_dict_names(CharacterVector n)
+{
+  if(n.length() == 0)
+    return false ;
+
+  std::set<std::string> keys ;
+  for(R_xlen_t i=0 ; i<n.length() ; i++)
+  {
+    if(STRING_ELT(n, i) == NA_STRING || n(i) == "")
+      return false ;
+
+    if(!keys.insert(Rf_translateCharUTF8(STRING_ELT(n, i))).second)
+      return false ;
+  }
+
+  return true ;
+}
+
+// Translate named R list to SWI-Prolog dict with unbound tag, e.g., list(a=1,
+// b=2) -> _{a:1, b:2}. The values are stored in consecutive term references,
+// as needed by PL_put_dict.
+PlTerm r2pl_dict(List r, CharacterVector n, CharacterVector& names, PlTerm& vars, List options)
+{
+  size_t len = r.size() ;
+  term_t values = PL_new_term_refs(len) ;
+  for(size_t i=0 ; i<len ; i++)
+    PlCheckFail(PL_put_term(values + i, r2pl(r(i), names, vars, options).C_)) ;
+
+  std::vector<atom_t> keys(len) ;
+  for(size_t i=0 ; i<len ; i++)
+    keys[i] = PL_new_atom_mbchars(REP_UTF8, (size_t) -1, Rf_translateCharUTF8(STRING_ELT(n, i))) ;
+
+  PlTerm_var pl ;
+  int ok = PL_put_dict(pl.C_, 0, len, keys.data(), values) ;
+  for(size_t i=0 ; i<len ; i++)
+    PL_unregister_atom(keys[i]) ;
+
+  PlCheckFail(ok) ;
+  return pl ;
+}
+
+// Single cell of a data.frame as an R vector of length 1. Factors are
+// translated to their labels.
+RObject r2pl_cell(SEXP col, R_xlen_t i)
+{
+  if(Rf_isFactor(col))
+  {
+    int level = INTEGER(col)[i] ;
+    if(level == NA_INTEGER)
+      return Rf_ScalarString(NA_STRING) ;
+
+    return Rf_ScalarString(STRING_ELT(Rf_getAttrib(col, R_LevelsSymbol), level - 1)) ;
+  }
+
+  switch(TYPEOF(col))
+  {
+    case REALSXP: return Rf_ScalarReal(REAL(col)[i]) ;
+    case INTSXP: return Rf_ScalarInteger(INTEGER(col)[i]) ;
+    case LGLSXP: return Rf_ScalarLogical(LOGICAL(col)[i]) ;
+    case STRSXP: return Rf_ScalarString(STRING_ELT(col, i)) ;
+    case VECSXP: return VECTOR_ELT(col, i) ;
+  }
+
+  return R_NilValue ;
+}
+
+// Translate data.frame to a list of dicts, one per row
+PlTerm r2pl_rows(List r, CharacterVector n, CharacterVector& names, PlTerm& vars, List options)
+{
+  R_xlen_t nrow = Rf_xlength(Rf_getAttrib(r, R_RowNamesSymbol)) ;
+  size_t ncol = r.size() ;
+
+  PlTerm_var pl ;
+  PlTerm_tail tail(pl) ;
+  for(R_xlen_t i=0 ; i<nrow ; i++)
+  {
+    List row(ncol) ;
+    for(size_t j=0 ; j<ncol ; j++)
+      row(j) = r2pl_cell(VECTOR_ELT(r, j), i) ;
+
+    PlCheckFail(tail.append(r2pl_dict(row, n, names, vars, options))) ;
+  }
+
+  PlCheckFail(tail.close()) ;
+  return pl ;
 }
 
 // Translate R list to prolog list, taking into account the names of the
@@ -828,6 +1802,9 @@ PlTerm r2pl_compound(Language r, CharacterVector& names, PlTerm& vars, List opti
 // minus sign is a bit specific to prolog, and the conversion in the reverse
 // direction may be ambiguous.
 //
+// With the option dict, named lists are translated to dicts, e.g., list(a=1,
+// b=2) -> _{a:1, b:2}, and data.frames to lists of dicts, one per row.
+//
 PlTerm r2pl_list(List r, CharacterVector& names, PlTerm& vars, List options)
 {
   // Names of list elements (empty vector if r.names() == NULL)  
@@ -835,21 +1812,36 @@ PlTerm r2pl_list(List r, CharacterVector& names, PlTerm& vars, List options)
   if(TYPEOF(r.names()) == STRSXP)
     n = as<CharacterVector>(r.names()) ;
   
-  PlTerm_var pl ;
-  PlTerm_tail tail(pl) ;
-  for(R_xlen_t i=0; i<r.size() ; i++)
+  if(option_true(options, "dict") && r2pl_dict_names(n))
+  {
+    if(Rf_inherits(r, "data.frame"))
+      return r2pl_rows(r, n, names, vars, options) ;
+
+    return r2pl_dict(r, n, names, vars, options) ;
+  }
+
+  // The list is built from the back, the term references are released after
+  // each element
+  static functor_t minus = PL_new_functor(PL_new_atom("-"), 2) ;
+  term_t pl = PL_new_term_ref() ;
+  PL_put_nil(pl) ;
+  term_t head = PL_new_term_ref() ;
+  for(R_xlen_t i=r.size()-1 ; i>=0 ; i--)
   {
+    term_t mark = PL_new_term_ref() ;
     PlTerm arg = r2pl(r(i), names, vars, options) ;
-    
+
     // Convert named argument to prolog pair a-X.
     if(n.length() && n(i) != "")
-      PlCheckFail(tail.append(PlCompound("-", PlTermv(PlTerm_atom(n(i)), arg)))) ;
+      PlCheckFail(PL_cons_functor(head, minus, PlTerm_atom(n(i)).C_, arg.C_)) ;
     else
-      PlCheckFail(tail.append(arg)) ; // no name
+      PlCheckFail(PL_put_term(head, arg.C_)) ; // no name
+
+    PlCheckFail(PL_cons_list(pl, head, pl)) ;
+    PL_reset_term_refs(mark) ;
   }
-  
-  PlCheckFail(tail.close()) ;
-  return pl ;
+
+  return PlTerm(pl) ;
 }
 
 // Translate R function to :- ("neck")
@@ -883,612 +1875,5360 @@ PlTerm r2pl_function(Function r, CharacterVector& names, PlTerm& vars, List opti
   return PlCompound(":-", fun) ;
 }
 
-PlTerm r2pl(SEXP r, CharacterVector& names, PlTerm& vars, List options)
+// Kind of R object, for the statistics
+RlKind r2pl_kind(SEXP r)
 {
-  if(TYPEOF(r) == LANGSXP)
-    return r2pl_compound(r, names, vars, options) ;
-
-  if(TYPEOF(r) == REALSXP)
-    return r2pl_real(r, options) ;
-  
-  if(TYPEOF(r) == LGLSXP)
-    return r2pl_logical(r, options) ;
-  
-  if(TYPEOF(r) == INTSXP)
-    return r2pl_integer(r, options) ;
-  
-  if(TYPEOF(r) == EXPRSXP)
-    return r2pl_var(r, names, vars, options) ;
+  switch(TYPEOF(r))
+  {
+    case NILSXP: return KIND_NULL ;
+    case REALSXP: return KIND_REAL ;
+    case INTSXP: return KIND_INTEGER ;
+    case LGLSXP: return KIND_LOGICAL ;
+    case STRSXP: return KIND_STRING ;
+    case SYMSXP: return KIND_ATOM ;
+    case EXPRSXP: return KIND_VARIABLE ;
+    case VECSXP: return KIND_LIST ;
+    case LANGSXP: return KIND_COMPOUND ;
+    case CLOSXP: return KIND_FUNCTION ;
+    case BUILTINSXP: return KIND_FUNCTION ;
+    case SPECIALSXP: return KIND_FUNCTION ;
+  }
 
-  if(TYPEOF(r) == SYMSXP)
-    return r2pl_atom(r) ;
+  return KIND_OTHER ;
+}
 
-  if(TYPEOF(r) == STRSXP)
-    return r2pl_string(r, options) ;
+// Name and formal arguments of a primitive R function (e.g., sin). The name
+// is obtained from its deparsed representation, .Primitive("sin"), and the
+// arguments from args().
+bool primitive_signature(SEXP r, std::string& name, CharacterVector& formals)
+{
+  CharacterVector d = Function("deparse")(r) ;
+  std::string chunk = as<std::string>(d(d.size() - 1)) ;
+  size_t b = chunk.find('"') ;
+  size_t e = chunk.find('"', b + 1) ;
+  RObject a = Function("args")(r) ;
+  if(b == std::string::npos || e == std::string::npos || TYPEOF(a) != CLOSXP)
+    return false ;
 
-  if(TYPEOF(r) == VECSXP)
-    return r2pl_list(r, names, vars, options) ;
-  
-  if(TYPEOF(r) == NILSXP)
-    return r2pl_null() ;
-  
-  if(TYPEOF(r) == CLOSXP)
-    return r2pl_function(r, names, vars, options) ;
-  
-  return r2pl_na() ;
+  name = chunk.substr(b + 1, e - b - 1) ;
+#if defined(R_VERSION) && R_VERSION >= R_Version(4, 5, 0)
+  List f = as<List>(R_ClosureFormals(a)) ;
+#else
+  List f = as<List>(FORMALS(a)) ;
+#endif
+  if(f.size())
+    formals = f.names() ;
+  return true ;
 }
 
-#ifdef RPACKAGE
-
-class RlQuery
+// Translate primitive R function (e.g., sin) to a regular function, that is, 
+// :-('$function'(x), sin(x)).
+PlTerm r2pl_primitive(SEXP r, List options)
 {
-  CharacterVector names ;
-  PlTerm_var vars ;
-  List options ;
-  Environment env ;
-  PlQuery* qid ;
+  std::string name ;
+  CharacterVector n ;
+  if(!primitive_signature(r, name, n))
+    return r2pl_na() ;
 
-public:
-  RlQuery(RObject aquery, List aoptions, Environment aenv) ;
-  ~RlQuery() ;
+  const char* functor = rename_functor(name.c_str(), options) ;
+  size_t len = (size_t) n.size() ;
+  PlTermv fun(2) ;
+  if(len == 0)
+  {
+    PlTermv head(3) ;
+    PlCheckFail(head[1].unify_atom("$function")) ;
+    PlCheckFail(head[2].unify_integer(0)) ;
+    PlCall("compound_name_arity", head) ;
+    PlCheckFail(fun[0].unify_term(head[0])) ;
+
+    PlTermv body(3) ;
+    PlCheckFail(body[1].unify_atom(functor)) ;
+    PlCheckFail(body[2].unify_integer(0)) ;
+    PlCall("compound_name_arity", body) ;
+    PlCheckFail(fun[1].unify_term(body[0])) ;
+    return PlCompound(":-", fun) ;
+  }
 
-  int next_solution() ;
+  PlTermv pl(len) ;
+  for(size_t i=0 ; i<len ; i++)
+    PlCheckFail(pl[i].unify_atom(n(i))) ;
+  PlCheckFail(fun[0].unify_term(PlCompound("$function", pl))) ;
+  PlCheckFail(fun[1].unify_term(PlCompound(functor, pl))) ;
+  return PlCompound(":-", fun) ;
+}
+
+// Codecs
+//
+// R objects with a class attribute are translated by the codec registered for
+// the class, and prolog compounds by the codec registered for their functor
+// (option codecs, default is TRUE). The compounds are tagged with '$r', so
+// that user terms and R calls like factor(a, b) keep their meaning. Built-in
+// codecs:
+//
+// factor -> '$r'(factor, Codes, Levels), e.g., '$r'(factor, %(1, 2, 1), $$("a", "b"))
+// Date -> '$r'('Date', Days)
+// POSIXct -> '$r'('POSIXct', Seconds, TimeZone)
+// data.frame -> '$r'('data.frame', Names, [Column1, Column2, ...])
+//
+// The encoders and decoders below see the untagged compound, e.g.,
+// factor(Codes, Levels).
+//
+// Further codecs can be registered from R (see rolog_codec) and from C/C++
+// via R_GetCCallable("rolog", "rolog_codec").
+//
+struct RlCodec
+{
+  std::string functor ;
+  size_t arity ;
 
-  List bindings() ;
+  // Built-in codecs
+  PlTerm (*encode)(SEXP r, CharacterVector& names, PlTerm& vars, List options) ;
+  RObject (*decode)(PlTerm pl, CharacterVector& names, PlTerm& vars, List options) ;
 
-  const List& get_options() const
-  {
-    return options ;
-  }
+  // Codecs from C/C++
+  int (*c_encode)(SEXP r, term_t pl) ;
+  SEXP (*c_decode)(term_t pl) ;
 
-  Environment& get_env()
-  {
-    return env ;
-  }
+  // Codecs from R: encode returns an R object that is translated to prolog,
+  // decode gets the compound translated to an R call (both preserved)
+  SEXP r_encode ;
+  SEXP r_decode ;
 } ;
 
-RlQuery::RlQuery(RObject aquery, List aoptions, Environment aenv)
-  : names(),
-    vars(),
-    options(aoptions),
-    env(aenv),
-    qid(NULL)
+// Empty R vector for [], others are coerced
+SEXP codec_vector(SEXP r, SEXPTYPE type)
 {
-  options("atomize") = false ;
-  PlTerm pl = r2pl(aquery, names, vars, options) ;
-  qid = new PlQuery("call", PlTermv(PlTerm(pl))) ;
+  if(Rf_isNull(r))
+    return Rf_allocVector(type, 0) ;
+
+  return Rf_coerceVector(r, type) ;
 }
 
-RlQuery::~RlQuery()
+PlTerm r2pl_factor(SEXP r, CharacterVector& names, PlTerm& vars, List options)
 {
-  if(qid)
-    delete qid ;
+  PlTermv args(2) ;
+  PlCheckFail(args[0].unify_term(r2pl_integer(r, options))) ;
+  PlCheckFail(args[1].unify_term(r2pl_string(Rf_getAttrib(r, R_LevelsSymbol), options))) ;
+  return PlCompound("factor", args) ;
 }
 
-int RlQuery::next_solution()
+RObject pl2r_factor(PlTerm pl, CharacterVector& names, PlTerm& vars, List options)
 {
-  if(qid == NULL)
-    stop("next_solution: no open query.") ;
+  IntegerVector r(codec_vector(pl2r(pl[1], names, vars, options), INTSXP)) ;
+  r.attr("levels") = codec_vector(pl2r(pl[2], names, vars, options), STRSXP) ;
+  r.attr("class") = "factor" ;
+  return r ;
+}
 
-  int q ;
-  try
-  {
-    q = qid->next_solution() ;
-  }
+PlTerm r2pl_date(SEXP r, CharacterVector& names, PlTerm& vars, List options)
+{
+  return PlCompound("Date", PlTermv(r2pl_real(as<NumericVector>(r), options))) ;
+}
 
-  catch(PlException& ex)
-  {
-    warning(ex.as_string(PlEncoding::Locale).c_str()) ;
-    PL_clear_exception() ;
-    stop("Query failed") ;
-  }
+RObject pl2r_date(PlTerm pl, CharacterVector& names, PlTerm& vars, List options)
+{
+  NumericVector r(codec_vector(pl2r(pl[1], names, vars, options), REALSXP)) ;
+  r.attr("class") = "Date" ;
+  return r ;
+}
 
-  return q ;
+PlTerm r2pl_posixct(SEXP r, CharacterVector& names, PlTerm& vars, List options)
+{
+  SEXP tz = Rf_getAttrib(r, Rf_install("tzone")) ;
+  PlTermv args(2) ;
+  PlCheckFail(args[0].unify_term(r2pl_real(as<NumericVector>(r), options))) ;
+  PlCheckFail(args[1].unify_term(PlTerm_string(
+    TYPEOF(tz) == STRSXP && XLENGTH(tz) ? Rf_translateCharUTF8(STRING_ELT(tz, 0)) : ""))) ;
+  return PlCompound("POSIXct", args) ;
+}
 
-/*
-  int q = qid->next_solution() ;
-  if(q == PL_S_TRUE)
-    return true ;
+RObject pl2r_posixct(PlTerm pl, CharacterVector& names, PlTerm& vars, List options)
+{
+  NumericVector r(codec_vector(pl2r(pl[1], names, vars, options), REALSXP)) ;
+  if(pl[2].is_string() && pl[2].as_string(PlEncoding::UTF8) != "")
+    r.attr("tzone") = pl[2].as_string(PlEncoding::UTF8) ;
+  r.attr("class") = CharacterVector::create("POSIXct", "POSIXt") ;
+  return r ;
+}
 
-  if(q == PL_S_LAST)
-    return true ;
+// With the option dict, the rows are translated to dicts, see r2pl_rows
+PlTerm r2pl_dataframe(SEXP r, CharacterVector& names, PlTerm& vars, List options)
+{
+  CharacterVector n(Rf_getAttrib(r, R_NamesSymbol)) ;
+  if(option_true(options, "dict") && r2pl_dict_names(n))
+    return r2pl_rows(r, n, names, vars, options) ;
+
+  List cols(XLENGTH(r)) ;
+  for(R_xlen_t i=0 ; i<XLENGTH(r) ; i++)
+    cols(i) = VECTOR_ELT(r, i) ;
+
+  PlTermv args(2) ;
+  PlCheckFail(args[0].unify_term(r2pl_string(n, options))) ;
+  PlCheckFail(args[1].unify_term(r2pl_list(cols, names, vars, options))) ;
+  return PlCompound("data.frame", args) ;
+}
 
-  if(q == PL_S_FALSE)
-  {
-    PL_close_query(qid) ;
-    qid = 0 ;
-    return false ;
-  }
+RObject pl2r_dataframe(PlTerm pl, CharacterVector& names, PlTerm& vars, List options)
+{
+  RObject c = pl2r(pl[2], names, vars, options) ;
+  List r = Rf_isNull(c) ? List(0) : as<List>(c) ;
+  r.names() = codec_vector(pl2r(pl[1], names, vars, options), STRSXP) ;
+  r.attr("row.names") = IntegerVector::create(NA_INTEGER, r.size() ? (int) -Rf_xlength(r(0)) : 0) ;
+  r.attr("class") = "data.frame" ;
+  return r ;
+}
 
-  if(q == PL_S_EXCEPTION)
-  {
-    PL_close_query(qid) ;
-    qid = 0 ;
+// Registry of the codecs by class name and by functor
+struct RlCodecs
+{
+  std::map<std::string, RlCodec> classes ;
+  std::map<std::pair<std::string, size_t>, std::string> functors ;
 
-    term_t ex = PL_exception(0) ;
-    char* err ;
-    if(PL_get_chars(ex, &err, BUF_DISCARDABLE|CVT_WRITE|REP_UTF8))
+  void add(const char* rclass, const RlCodec& codec)
+  {
+    std::map<std::string, RlCodec>::iterator old = classes.find(rclass) ;
+    if(old != classes.end())
     {
-      PL_clear_exception() ;
-      warning(err) ;
-      return false ;
+      functors.erase(std::make_pair(old->second.functor, old->second.arity)) ;
+      if(old->second.r_encode)
+        R_ReleaseObject(old->second.r_encode) ;
+      if(old->second.r_decode)
+        R_ReleaseObject(old->second.r_decode) ;
     }
 
-    PL_clear_exception() ;
-    warning("query: unknown exception occurred") ;
-    return false ;
+    classes[rclass] = codec ;
+    functors[std::make_pair(codec.functor, codec.arity)] = rclass ;
   }
 
-  // should not be reached
-  return q ;
-  */
-}
-
-List RlQuery::bindings()
-{
-  List l ;
-
-  PlTerm_tail tail(vars) ;
-  PlTerm_var v ;
-  for(int i=0 ; i<names.length() ; i++)
+  RlCodecs()
   {
-    PlCheckFail(tail.next(v)) ;
-    RObject r = pl2r(v, names, vars, options) ;
-    if(TYPEOF(r) == EXPRSXP && names[i] == as<Symbol>(as<ExpressionVector>(r)[0]).c_str())
-    continue ;
-
-    l.push_back(r, (const char*) names[i]) ;
+    add("factor", { "factor", 2, r2pl_factor, pl2r_factor, NULL, NULL, NULL, NULL }) ;
+    add("Date", { "Date", 1, r2pl_date, pl2r_date, NULL, NULL, NULL, NULL }) ;
+    add("POSIXct", { "POSIXct", 2, r2pl_posixct, pl2r_posixct, NULL, NULL, NULL, NULL }) ;
+    add("data.frame", { "data.frame", 2, r2pl_dataframe, pl2r_dataframe, NULL, NULL, NULL, NULL }) ;
   }
+} ;
 
-  return l ;
+static RlCodecs& rolog_codecs()
+{
+  static RlCodecs codecs ;
+  return codecs ;
 }
 
-static RlQuery* query_id = NULL ;
-
-// Open a query for later use.
-// [[Rcpp::export(.query)]]
-RObject query_(RObject query, List options, Environment env)
+// Codec for the first class of r that has one
+const RlCodec* codec_class(SEXP r)
 {
-  if(query_id || PL_current_query())
+  SEXP cl = Rf_getAttrib(r, R_ClassSymbol) ;
+  std::map<std::string, RlCodec>& classes = rolog_codecs().classes ;
+  for(R_xlen_t i=0 ; i<XLENGTH(cl) ; i++)
   {
-    warning("Cannot raise simultaneous queries. Please invoke clear()") ;
-    return wrap(false) ;
+    std::map<std::string, RlCodec>::const_iterator c = classes.find(CHAR(STRING_ELT(cl, i))) ;
+    if(c != classes.end())
+      return &c->second ;
   }
 
-  query_id = new RlQuery(query, options, env) ;
-  return wrap(true) ;
+  return NULL ;
 }
 
-// Clear query (and invoke cleanup handlers, see PL_close_query)
-// [[Rcpp::export(.clear)]]
-RObject clear_()
+// Tag of the compounds of the codecs
+static atom_t codec_tag()
 {
-  if(query_id)
-    delete query_id ;
-  query_id = NULL ;
+  static atom_t tag = PL_new_atom("$r") ;
+  return tag ;
+}
 
-  return wrap(true) ;
+// Tag the compound of a codec, factor(Codes, Levels) -> '$r'(factor, Codes,
+// Levels). Other terms (e.g., the rows of a data.frame with option dict) are
+// returned as they are.
+PlTerm codec_wrap(const RlCodec& c, PlTerm pl)
+{
+  atom_t name ;
+  size_t arity ;
+  if(!PL_get_name_arity(pl.C_, &name, &arity) || arity != c.arity
+     || PlAtom(name).as_string(PlEncoding::UTF8) != c.functor)
+    return pl ;
+
+  term_t args = PL_new_term_refs(arity + 1) ;
+  PL_put_atom(args, name) ;
+  for(size_t i=0 ; i<arity ; i++)
+    PlCheckFail(PL_get_arg(i+1, pl.C_, args+i+1)) ;
+
+  term_t t = PL_new_term_ref() ;
+  PlCheckFail(PL_cons_functor_v(t, PL_new_functor(codec_tag(), arity+1), args)) ;
+  return PlTerm(t) ;
 }
 
-// Submit query
-// [[Rcpp::export(.submit)]]
-RObject submit_()
+bool r2pl_codec(SEXP r, PlTerm& pl, CharacterVector& names, PlTerm& vars, List options)
 {
-  if(query_id == NULL)
+  if(!OBJECT(r) || !option_true(options, "codecs"))
+    return false ;
+
+  const RlCodec* c = codec_class(r) ;
+  if(c == NULL)
+    return false ;
+
+  PlTerm_var t ;
+  if(c->encode)
+    PlCheckFail(t.unify_term(c->encode(r, names, vars, options))) ;
+
+  if(c->c_encode)
   {
-    warning("submit: no open query.") ;
-    return wrap(false) ;
+    if(!c->c_encode(r, t.C_))
+      stop("r2pl: codec for %s failed", c->functor.c_str()) ;
   }
 
-  if(!query_id->next_solution())
+  if(c->r_encode)
   {
-    delete query_id ;
-    query_id = NULL ;
-    return wrap(false) ;
+    Function f(c->r_encode) ;
+    PlCheckFail(t.unify_term(r2pl(f(r), names, vars, options))) ;
   }
 
-  return query_id->bindings() ;
+  PlCheckFail(pl.unify_term(codec_wrap(*c, t))) ;
+  return true ;
 }
 
-// Execute a query once and return conditions
-//
-// Examples:
-//
-// once(call("=", 1, 2)) -> FALSE
-// once(call("=", 1, 1)) -> empty list
-// once(call("member", 1, list(2, expression(X)))) -> list stating that X = 1
-// once(call("=", list(expression(X), expression(Y)), list(1, expression(Z))))
-//   -> list stating that X = 1 and Z = Y
-// once(call("member", 1, expression(X))) -> list stating that X = [1 | _]; 
-//   e.g., something like [|]`(1, expression(`_6330`)). This is cumbersome, any
-//   better ideas are welcome.
-//
-// [[Rcpp::export(.once)]]
-RObject once_(RObject query, List options, Environment env)
+// Only tagged compounds are decoded, '$r'(factor, Codes, Levels) is passed to
+// the decoder as factor(Codes, Levels)
+bool pl2r_codec(PlTerm pl, RObject& r, CharacterVector& names, PlTerm& vars, List options)
 {
-  PlFrame f ;
-  if(!query_(query, options, env))
-    stop("Could not create query.") ;
-    
-  RObject l = submit_() ;
-  clear_() ;
-  return l ;
-}
+  if(!option_true(options, "codecs"))
+    return false ;
 
-// Same as once_ above, but return all solutions to a query.
-// [[Rcpp::export(.findall)]]
-List findall_(RObject query, List options, Environment env)
-{
-  PlFrame f ;
-  if(!query_(query, options, env))
-    stop("Could not create query.") ;
-    
-  List results ;
-  while(true)
+  atom_t tag, name ;
+  size_t arity ;
+  if(!PL_get_name_arity(pl.C_, &tag, &arity) || tag != codec_tag() || arity == 0)
+    return false ;
+
+  term_t a = PL_new_term_ref() ;
+  if(!PL_get_arg(1, pl.C_, a) || !PL_get_atom(a, &name))
+    return false ;
+
+  RlCodecs& codecs = rolog_codecs() ;
+  std::map<std::pair<std::string, size_t>, std::string>::const_iterator f =
+    codecs.functors.find(std::make_pair(PlAtom(name).as_string(PlEncoding::UTF8), arity-1)) ;
+  if(f == codecs.functors.end())
+    return false ;
+
+  // Untagged compound
+  term_t t = PL_new_term_ref() ;
+  if(arity == 1)
+    PL_put_atom(t, name) ;
+  else
   {
-    RObject l = submit_() ;
-    if(TYPEOF(l) == LGLSXP)
-      break ;
-    
-    results.push_back(l) ;
+    term_t args = PL_new_term_refs(arity-1) ;
+    for(size_t i=1 ; i<arity ; i++)
+      PlCheckFail(PL_get_arg(i+1, pl.C_, args+i-1)) ;
+    PlCheckFail(PL_cons_functor_v(t, PL_new_functor(name, arity-1), args)) ;
   }
-  
-  clear_() ;
-  return results ;
-}
 
-// Consult one or more files. If something fails, the procedure stops, and
-// will not try to consult the remaining files.
-//
-// [[Rcpp::export(.consult)]]
-LogicalVector consult_(CharacterVector files)
-{
-  for(R_xlen_t i=0; i<files.size(); i++)
+  PlTerm u(t) ;
+  const RlCodec& c = codecs.classes[f->second] ;
+  if(c.decode)
+    r = c.decode(u, names, vars, options) ;
+
+  if(c.c_decode)
+    r = c.c_decode(u.C_) ;
+
+  if(c.r_decode)
   {
-    try 
-    {
-      PlCall("consult", PlTermv(PlTerm_string(files(i))));
-    }
-    
-    catch(PlException& ex)
-    { 
-      String err(ex.as_string(PlEncoding::Locale));
-      PL_clear_exception() ;
-      stop("failed to consult %s: %s", (char*) files(i), err.get_cstring()) ;
-    }
+    Function d(c.r_decode) ;
+    r = d(pl2r_compound(u, names, vars, options)) ;
   }
 
   return true ;
 }
 
-// Pretty print query
-//
-// [[Rcpp::export(.portray)]]
-RObject portray_(RObject query, List options)
+PlTerm r2pl(SEXP r, CharacterVector& names, PlTerm& vars, List options)
 {
-  if(PL_current_query() != 0)
+  RlConversion c(rolog_stats.r2pl, r2pl_kind(r)) ;
+
+  if(OBJECT(r))
   {
-    warning("Closing the current query.") ;
-    clear_() ;
+    if(Rf_inherits(r, "rolog_stream"))
+    {
+      SEXP chunk = Rf_getAttrib(r, Rf_install("chunk")) ;
+      return r2pl_stream(r, Rf_isNull(chunk) ? 10000 : Rf_asInteger(chunk), options) ;
+    }
+
+    PlTerm_var pl ;
+    if(r2pl_codec(r, pl, names, vars, options))
+      return pl ;
   }
 
-  CharacterVector names ;
-  PlTerm_var vars ;
-  options("atomize") = true ; // translate variables to their R names
-  PlTermv pl(3) ;
-  PlCheckFail(pl[0].unify_term(r2pl(query, names, vars, options))) ;
-  PlTerm_tail tail(pl[2]) ;
-  PlCheckFail(tail.append(PlCompound("quoted", PlTermv(PlTerm_atom("false"))))) ;
-  PlCheckFail(tail.append(PlCompound("spacing", PlTermv(PlTerm_atom("next_argument"))))) ;
-  PlCheckFail(tail.close()) ;
+  if(TYPEOF(r) == LANGSXP)
+    return r2pl_compound(r, names, vars, options) ;
 
-  PlFrame f ;
-  PlQuery q("term_string", pl) ;
-  try
-  {
-    if(!q.next_solution())
-      return wrap(false) ;
-  }
+  if(TYPEOF(r) == REALSXP)
+    return r2pl_real(r, options) ;
   
-  catch(PlException& ex)
-  {
-    warning(ex.as_string(PlEncoding::Locale).c_str()) ;
-    PL_clear_exception() ;
-    stop("portray of %s failed.", pl[0].as_string(PlEncoding::Locale).c_str()) ;
-  }
+  if(TYPEOF(r) == LGLSXP)
+    return r2pl_logical(r, options) ;
+  
+  if(TYPEOF(r) == INTSXP)
+    return r2pl_integer(r, options) ;
+  
+  if(TYPEOF(r) == EXPRSXP)
+    return r2pl_var(r, names, vars, options) ;
+
+  if(TYPEOF(r) == SYMSXP)
+    return r2pl_atom(r, names, vars, options) ;
+
+  if(TYPEOF(r) == STRSXP)
+    return r2pl_string(r, options) ;
+
+  if(TYPEOF(r) == VECSXP)
+    return r2pl_list(r, names, vars, options) ;
+  
+  if(TYPEOF(r) == NILSXP)
+    return r2pl_null() ;
+  
+  if(TYPEOF(r) == CLOSXP)
+    return r2pl_function(r, names, vars, options) ;
   
-  return pl2r(pl[1], names, vars, options) ;
+  if(TYPEOF(r) == BUILTINSXP || TYPEOF(r) == SPECIALSXP)
+    return r2pl_primitive(r, options) ;
+
+  return r2pl_na() ;
 }
 
-// Execute a query given as a string
+// Fast transfer
 //
-// Example:
-// once("use_module(library(http/html_write))")
+// With the option transfer = "fast", the terms are not translated node by
+// node with the functions above. R objects are written as prolog text in one
+// pass and read with a single call of PL_chars_to_term. Prolog terms are
+// recorded with PL_record_external, and the record is decoded to R objects
+// in one pass. The results are the same as with the default converters.
 //
-// [[Rcpp::export(.call)]]
+// Only the common cases are handled this way: calls, lists, symbols,
+// variables, atomic vectors, and compounds like ##(1.0, 2.0), with ASCII
+// names and text, finite numbers and integers. For anything else (e.g.,
+// codecs, functions, dicts, matrices, partial lists, variables in the
+// results), the whole term is translated by the default converters.
+//
+// The codes in the external records are those of pl-rec.c in SWI-Prolog.
+// They are not part of the documented interface; therefore, the decoder is
+// checked once against pl2r with a few known terms, and if the results
+// differ, the default converters are used.
+//
+bool option_fast(List& options)
+{
+  if(!options.containsElementNamed("transfer"))
+    return false ;
+
+  SEXP t = options["transfer"] ;
+  return TYPEOF(t) == STRSXP && XLENGTH(t) && !strcmp(CHAR(STRING_ELT(t, 0)), "fast") ;
+}
+
+static bool fast_ascii(const char* s)
+{
+  for(const unsigned char* c=(const unsigned char*) s ; *c ; c++)
+    if(*c > 127)
+      return false ;
+
+  return true ;
+}
+
+// R -> prolog text. The variables are named _V0, _V1, ..., numbered in the
+// order in which r2pl registers them (the lists are built from the back).
+struct RlFastWriter
+{
+  List& options ;
+  std::string text ;
+  std::map<std::string, size_t> index ;
+  std::vector<std::string> order ;
+  bool scalar ;
+  bool atomize ;
+  bool simplified ;
+  bool dict ;
+
+  RlFastWriter(List& aoptions)
+    : options(aoptions),
+      text(),
+      index(),
+      order(),
+      scalar(option_true(aoptions, "scalar")),
+      atomize(option_true(aoptions, "atomize")),
+      simplified(option_true(aoptions, "simplified")),
+      dict(option_true(aoptions, "dict"))
+  {
+  }
+
+  void variable(const char* name)
+  {
+    if(atomize || !strcmp(name, "_") || index.count(name))
+      return ;
+
+    index[name] = order.size() ;
+    order.push_back(name) ;
+  }
+
+  // Variables in the order of r2pl
+  void variables(SEXP r)
+  {
+    switch(TYPEOF(r))
+    {
+      case LANGSXP:
+        for(SEXP a=CDR(r) ; a != R_NilValue ; a=CDR(a))
+          variables(CAR(a)) ;
+        return ;
+
+      case VECSXP:
+        for(R_xlen_t i=XLENGTH(r)-1 ; i>=0 ; i--)
+          variables(VECTOR_ELT(r, i)) ;
+        return ;
+
+      case EXPRSXP:
+        if(XLENGTH(r) && TYPEOF(VECTOR_ELT(r, 0)) == SYMSXP)
+          variable(CHAR(PRINTNAME(VECTOR_ELT(r, 0)))) ;
+        return ;
+
+      case SYMSXP:
+        if(simplified && CHAR(PRINTNAME(r))[0] == '.')
+          variable(CHAR(PRINTNAME(r))[1] ? CHAR(PRINTNAME(r)) + 1 : "_") ;
+        return ;
+    }
+  }
+
+  // Quoted atom or string, non-printable characters are escaped
+  bool quoted(const char* s, char q)
+  {
+    if(!fast_ascii(s))
+      return false ;
+
+    text += q ;
+    for(const char* c=s ; *c ; c++)
+    {
+      if(*c == q || *c == '\\')
+        text += '\\' ;
+
+      if(*c < 32 || *c == 127)
+      {
+        char buf[8] ;
+        snprintf(buf, sizeof(buf), "\\x%x\\", *c) ;
+        text += buf ;
+        continue ;
+      }
+
+      text += *c ;
+    }
+
+    text += q ;
+    return true ;
+  }
+
+  bool atom(const char* s)
+  {
+    return quoted(s, '\'') ;
+  }
+
+  bool var(const char* name)
+  {
+    if(atomize)
+      return atom(name) ;
+
+    if(!strcmp(name, "_"))
+    {
+      text += '_' ;
+      return true ;
+    }
+
+    text += "_V" + std::to_string(index[name]) ;
+    return true ;
+  }
+
+  // Shortest text that is read back as the same float
+  bool real(double x)
+  {
+    if(ISNA(x))
+    {
+      text += "na" ;
+      return true ;
+    }
+
+    if(!R_FINITE(x))
+      return false ;
+
+    char buf[40] ;
+    snprintf(buf, sizeof(buf), "%.17g", x) ;
+    std::string s(buf) ;
+    if(s.find('.') == std::string::npos)
+    {
+      size_t e = s.find('e') ;
+      s.insert(e == std::string::npos ? s.size() : e, ".0") ;
+    }
+
+    text += s ;
+    return true ;
+  }
+
+  bool integer(int x)
+  {
+    text += x == NA_INTEGER ? "na" : std::to_string(x) ;
+    return true ;
+  }
+
+  bool logical(int x)
+  {
+    text += x == NA_LOGICAL ? "na" : (x ? "true" : "false") ;
+    return true ;
+  }
+
+  bool string(SEXP x)
+  {
+    if(x == NA_STRING)
+    {
+      text += "na" ;
+      return true ;
+    }
+
+    return quoted(CHAR(x), '"') ;
+  }
+
+  // Scalar, or compound like ##(1.0, 2.0), see r2pl_real and the like
+  bool vector(SEXP r, const char* option)
+  {
+    if(Rf_isMatrix(r))
+      return false ;
+
+    R_xlen_t len = XLENGTH(r) ;
+    if(len == 0)
+    {
+      text += "[]" ;
+      return true ;
+    }
+
+    bool compound = !scalar || len > 1 ;
+    if(compound)
+    {
+      if(!atom((const char*) options(option)))
+        return false ;
+      text += '(' ;
+    }
+
+    for(R_xlen_t i=0 ; i<len ; i++)
+    {
+      if(i)
+        text += ',' ;
+
+      bool ok = true ;
+      switch(TYPEOF(r))
+      {
+        case REALSXP: ok = real(REAL(r)[i]) ; break ;
+        case INTSXP: ok = integer(INTEGER(r)[i]) ; break ;
+        case LGLSXP: ok = logical(LOGICAL(r)[i]) ; break ;
+        case STRSXP: ok = string(STRING_ELT(r, i)) ; break ;
+      }
+
+      if(!ok)
+        return false ;
+    }
+
+    if(compound)
+      text += ')' ;
+    return true ;
+  }
+
+  // See r2pl_compound
+  bool call(SEXP r)
+  {
+    if(TYPEOF(CAR(r)) != SYMSXP)
+      return false ;
+
+    const char* head = CHAR(PRINTNAME(CAR(r))) ;
+    if(simplified && (!strcmp(head, "(") || !strcmp(head, "[") || !strcmp(head, "list")))
+      return false ;
+
+    if(!atom(rename_functor(head, options)))
+      return false ;
+
+    text += '(' ;
+    for(SEXP a=CDR(r) ; a != R_NilValue ; a=CDR(a))
+    {
+      if(a != CDR(r))
+        text += ',' ;
+
+      bool named = TAG(a) != R_NilValue && CHAR(PRINTNAME(TAG(a)))[0] ;
+      if(named)
+      {
+        text += "'='(" ;
+        if(!atom(CHAR(PRINTNAME(TAG(a)))))
+          return false ;
+        text += ',' ;
+      }
+
+      if(!value(CAR(a)))
+        return false ;
+
+      if(named)
+        text += ')' ;
+    }
+
+    text += ')' ;
+    return true ;
+  }
+
+  // See r2pl_list
+  bool list(SEXP r)
+  {
+    SEXP n = Rf_getAttrib(r, R_NamesSymbol) ;
+    if(TYPEOF(n) != STRSXP)
+      n = R_NilValue ;
+
+    if(dict && !Rf_isNull(n) && r2pl_dict_names(n))
+      return false ;
+
+    text += '[' ;
+    for(R_xlen_t i=0 ; i<XLENGTH(r) ; i++)
+    {
+      if(i)
+        text += ',' ;
+
+      bool named = !Rf_isNull(n) && CHAR(STRING_ELT(n, i))[0] ;
+      if(named)
+      {
+        text += "'-'(" ;
+        if(!atom(CHAR(STRING_ELT(n, i))))
+          return false ;
+        text += ',' ;
+      }
+
+      if(!value(VECTOR_ELT(r, i)))
+        return false ;
+
+      if(named)
+        text += ')' ;
+    }
+
+    text += ']' ;
+    return true ;
+  }
+
+  bool value(SEXP r)
+  {
+    if(OBJECT(r))
+      return false ;
+
+    switch(TYPEOF(r))
+    {
+      case LANGSXP: return call(r) ;
+      case REALSXP: return vector(r, "realvec") ;
+      case LGLSXP: return vector(r, "boolvec") ;
+      case INTSXP: return vector(r, "intvec") ;
+      case STRSXP: return vector(r, "charvec") ;
+      case VECSXP: return list(r) ;
+
+      case NILSXP:
+        text += "[]" ;
+        return true ;
+
+      case EXPRSXP:
+        if(XLENGTH(r) == 0 || TYPEOF(VECTOR_ELT(r, 0)) != SYMSXP)
+          return false ;
+        return var(CHAR(PRINTNAME(VECTOR_ELT(r, 0)))) ;
+
+      case SYMSXP:
+      {
+        const char* s = CHAR(PRINTNAME(r)) ;
+        if(simplified && s[0] == '.')
+          return var(s[1] ? s + 1 : "_") ;
+        return atom(s) ;
+      }
+    }
+
+    return false ;
+  }
+} ;
+
+bool r2pl_fast(SEXP r, PlTerm& pl, CharacterVector& names, PlTerm& vars, List options)
+{
+  RlConversion c(rolog_stats.r2pl, r2pl_kind(r)) ;
+  RlFastWriter w(options) ;
+  w.variables(r) ;
+  w.text = "v([" ;
+  for(size_t i=0 ; i<w.order.size() ; i++)
+    w.text += (i ? ",_V" : "_V") + std::to_string(i) ;
+  w.text += "]," ;
+  if(!w.value(r))
+    return false ;
+  w.text += ')' ;
+
+  PlTerm_var t ;
+  if(!PL_chars_to_term(w.text.c_str(), t.C_))
+    return false ;
+
+  // Unify the variables with those of the query, or register new ones
+  term_t list = PL_copy_term_ref(t[1].C_) ;
+  term_t v = PL_new_term_ref() ;
+  for(size_t i=0 ; i<w.order.size() ; i++)
+  {
+    PlCheckFail(PL_get_list(list, v, list)) ;
+    PlCheckFail(PlTerm(v).unify_term(r2pl_varname(Symbol(w.order[i]), names, vars, options))) ;
+  }
+
+  PlCheckFail(pl.unify_term(t[2])) ;
+  return true ;
+}
+
+// Codes in external records
+enum RlRecordCode
+{
+  REC_TAGGED_INTEGER = 4,
+  REC_STRING = 6,
+  REC_CONS = 8,
+  REC_NIL = 9,
+  REC_EXT_ATOM = 11,
+  REC_EXT_FLOAT = 14,
+  REC_EXT_COMPOUND = 20
+} ;
+
+// Flags in the first byte of the record
+static const int REC_FLAG_INT = 0x04 ;
+static const int REC_FLAG_ATOM = 0x08 ;
+static const int REC_FLAG_GROUND = 0x10 ;
+
+// Prolog record -> R, see pl2r for the translation
+struct RlRecordReader
+{
+  const unsigned char* p ;
+  const unsigned char* end ;
+  List& options ;
+  bool rewrite ;
+  bool codecs ;
+
+  RlRecordReader(const char* rec, size_t len, List& aoptions)
+    : p((const unsigned char*) rec),
+      end((const unsigned char*) rec + len),
+      options(aoptions),
+      rewrite(option_true(aoptions, "rewrite")),
+      codecs(option_true(aoptions, "codecs"))
+  {
+  }
+
+  bool byte(int& b)
+  {
+    if(p >= end)
+      return false ;
+
+    b = *p++ ;
+    return true ;
+  }
+
+  // Unsigned number, 7 bits per byte, the most significant first, with the
+  // high bit set in all but the last byte
+  bool size(size_t& n)
+  {
+    n = 0 ;
+    for(int i=0 ; i<10 ; i++)
+    {
+      int b ;
+      if(!byte(b))
+        return false ;
+
+      n = (n << 7) | (b & 0x7f) ;
+      if(!(b & 0x80))
+        return true ;
+    }
+
+    return false ;
+  }
+
+  // Signed number, the number of bytes followed by the bytes, the most
+  // significant first
+  bool int64(int64_t& v)
+  {
+    int n ;
+    if(!byte(n) || n < 1 || n > 8 || end - p < n)
+      return false ;
+
+    uint64_t u = (*p & 0x80) ? ~(uint64_t) 0 : 0 ;
+    for(int i=0 ; i<n ; i++)
+      u = (u << 8) | *p++ ;
+
+    v = (int64_t) u ;
+    return true ;
+  }
+
+  // Double in little-endian byte order
+  bool real(double& d)
+  {
+    if(end - p < 8)
+      return false ;
+
+    uint64_t u = 0 ;
+    for(int i=7 ; i>=0 ; i--)
+      u = (u << 8) | p[i] ;
+
+    p += 8 ;
+    memcpy(&d, &u, sizeof(d)) ;
+    return true ;
+  }
+
+  // Length and text, ASCII only
+  bool text(std::string& s)
+  {
+    size_t n ;
+    if(!size(n) || (size_t) (end - p) < n)
+      return false ;
+
+    s.assign((const char*) p, n) ;
+    p += n ;
+    for(size_t i=0 ; i<n ; i++)
+      if(s[i] <= 0 || s[i] == 127)
+        return false ;
+
+    return true ;
+  }
+
+  // Strings start with B (ISO Latin 1) or W (wide)
+  bool string(std::string& s)
+  {
+    if(!text(s) || s.empty() || s[0] != 'B')
+      return false ;
+
+    s.erase(0, 1) ;
+    return true ;
+  }
+
+  bool atom(std::string& s)
+  {
+    int op ;
+    return byte(op) && op == REC_EXT_ATOM && text(s) ;
+  }
+
+  // Atom, or [] as in PL_get_atom. If the next term is something else, the
+  // position is restored.
+  bool key(std::string& s)
+  {
+    const unsigned char* p0 = p ;
+    if(p < end && *p == REC_NIL)
+    {
+      p++ ;
+      s = "[]" ;
+      return true ;
+    }
+
+    if(atom(s))
+      return true ;
+
+    p = p0 ;
+    return false ;
+  }
+
+  // Compound Name(K, X) with atom K, e.g., a-1 and a=1. If the next term is
+  // something else, the position is restored.
+  bool pair(const char* name, std::string& k)
+  {
+    const unsigned char* p0 = p ;
+    int op ;
+    size_t arity ;
+    std::string f ;
+    if(byte(op) && op == REC_EXT_COMPOUND && size(arity) && arity == 2
+       && atom(f) && f == name && key(k))
+      return true ;
+
+    p = p0 ;
+    return false ;
+  }
+
+  bool record(RObject& r)
+  {
+    int flags ;
+    size_t code, gsize ;
+    if(!byte(flags) || (flags & (REC_FLAG_INT | REC_FLAG_ATOM)) || !(flags & REC_FLAG_GROUND))
+      return false ;
+
+    if(!size(code) || !size(gsize) || (size_t) (end - p) != code)
+      return false ;
+
+    return value(r) && p == end ;
+  }
+
+  bool value(RObject& r)
+  {
+    int op ;
+    if(!byte(op))
+      return false ;
+
+    switch(op)
+    {
+      case REC_NIL:
+        r = R_NilValue ;
+        return true ;
+
+      case REC_TAGGED_INTEGER:
+      {
+        int64_t v ;
+        if(!int64(v) || v <= INT_MIN || v > INT_MAX)
+          return false ;
+        r = Rf_ScalarInteger((int) v) ;
+        return true ;
+      }
+
+      case REC_EXT_FLOAT:
+      {
+        double d ;
+        if(!real(d))
+          return false ;
+        r = Rf_ScalarReal(d) ;
+        return true ;
+      }
+
+      case REC_STRING:
+      {
+        std::string s ;
+        if(!string(s))
+          return false ;
+        r = Rf_mkString(s.c_str()) ;
+        return true ;
+      }
+
+      case REC_EXT_ATOM:
+      {
+        std::string s ;
+        if(!text(s))
+          return false ;
+        return symbol(s, r) ;
+      }
+
+      case REC_CONS:
+        return list(r) ;
+
+      case REC_EXT_COMPOUND:
+        return compound(r) ;
+    }
+
+    return false ;
+  }
+
+  // See pl2r_symbol
+  bool symbol(const std::string& s, RObject& r)
+  {
+    if(s == "na")
+      r = wrap(NA_LOGICAL) ;
+    else if(s == "true")
+      r = wrap(true) ;
+    else if(s == "false")
+      r = wrap(false) ;
+    else if(s == "{}" && rewrite)
+      r = R_NilValue ;
+    else if(s == "")
+      return false ;
+    else
+      r = Rf_install(s.c_str()) ;
+
+    return true ;
+  }
+
+  // See pl2r_list, the first cell is already consumed
+  bool list(RObject& r)
+  {
+    std::vector<RObject> items ;
+    std::vector<std::string> keys ;
+    bool named = false ;
+    int op = REC_CONS ;
+    while(op == REC_CONS)
+    {
+      std::string k ;
+      if(pair("-", k))
+        named = true ;
+
+      RObject x ;
+      if(!value(x))
+        return false ;
+
+      items.push_back(x) ;
+      keys.push_back(k) ;
+      if(!byte(op))
+        return false ;
+    }
+
+    if(op != REC_NIL)
+      return false ;
+
+    List l(items.size()) ;
+    for(size_t i=0 ; i<items.size() ; i++)
+      l(i) = items[i] ;
+
+    if(named)
+      l.names() = wrap(keys) ;
+
+    r = l ;
+    return true ;
+  }
+
+  // Elements of ##(1.0, 2.0, na) and the like, see pl2r_realvec etc.
+  bool element(SEXP v, R_xlen_t i)
+  {
+    int op ;
+    if(!byte(op))
+      return false ;
+
+    std::string s ;
+    int64_t n ;
+    double d ;
+    if(op == REC_EXT_ATOM && !text(s))
+      return false ;
+
+    switch(TYPEOF(v))
+    {
+      case REALSXP:
+        if(op == REC_EXT_FLOAT && real(d))
+          REAL(v)[i] = d ;
+        else if(op == REC_TAGGED_INTEGER && int64(n) && n >= -(1LL << 53) && n <= (1LL << 53))
+          REAL(v)[i] = (double) n ;
+        else if(op == REC_EXT_ATOM && s == "na")
+          REAL(v)[i] = NA_REAL ;
+        else
+          return false ;
+        return true ;
+
+      case INTSXP:
+        if(op == REC_TAGGED_INTEGER && int64(n) && n > INT_MIN && n <= INT_MAX)
+          INTEGER(v)[i] = (int) n ;
+        else if(op == REC_EXT_ATOM && s == "na")
+          INTEGER(v)[i] = NA_INTEGER ;
+        else
+          return false ;
+        return true ;
+
+      case LGLSXP:
+        if(op == REC_EXT_ATOM && (s == "na" || s == "true" || s == "false"))
+          LOGICAL(v)[i] = s == "na" ? NA_LOGICAL : s == "true" ;
+        else
+          return false ;
+        return true ;
+
+      case STRSXP:
+        if(op == REC_EXT_ATOM)
+          SET_STRING_ELT(v, i, s == "na" ? NA_STRING : Rf_mkChar(s.c_str())) ;
+        else if(op == REC_STRING && string(s))
+          SET_STRING_ELT(v, i, Rf_mkChar(s.c_str())) ;
+        else
+          return false ;
+        return true ;
+    }
+
+    return false ;
+  }
+
+  bool vector(SEXPTYPE type, size_t arity, RObject& r)
+  {
+    RObject v = Rf_allocVector(type, arity) ;
+    for(size_t i=0 ; i<arity ; i++)
+      if(!element(v, i))
+        return false ;
+
+    r = v ;
+    return true ;
+  }
+
+  // See pl2r and pl2r_compound, the code is already consumed
+  bool compound(RObject& r)
+  {
+    size_t arity ;
+    std::string name ;
+    if(!size(arity) || !atom(name))
+      return false ;
+
+    // Rewrites and codecs
+    if(rewrite && ((arity == 2 && (name == "::" || name == "=<" || name == "[]"))
+                   || (arity == 1 && name == "{}") || name == "#"))
+      return false ;
+
+    if(codecs && name == "$r" && arity > 0)
+      return false ;
+
+    // Vectors, matrices and functions
+    if(name == (const char*) options("realvec"))
+      return vector(REALSXP, arity, r) ;
+
+    if(name == (const char*) options("intvec"))
+      return vector(INTSXP, arity, r) ;
+
+    if(name == (const char*) options("boolvec"))
+      return vector(LGLSXP, arity, r) ;
+
+    if(name == (const char*) options("charvec"))
+      return vector(STRSXP, arity, r) ;
+
+    if(name == (const char*) options("realmat") || name == (const char*) options("intmat")
+       || name == (const char*) options("boolmat") || name == (const char*) options("charmat")
+       || name == ":-")
+      return false ;
+
+    // Calls, see pl2r_call. The arguments are collected first, so that the
+    // call is built from the back in linear time.
+    std::vector<RObject> args(arity) ;
+    std::vector<std::string> keys(arity) ;
+    for(size_t i=0 ; i<arity ; i++)
+    {
+      pair("=", keys[i]) ;
+      if(!value(args[i]))
+        return false ;
+    }
+
+    RObject call = R_NilValue ;
+    for(size_t i=arity ; i>0 ; i--)
+    {
+      call = Rf_cons(args[i-1], call) ;
+      if(!keys[i-1].empty())
+        SET_TAG(call, Rf_install(keys[i-1].c_str())) ;
+    }
+
+    r = Rf_lcons(Rf_install(rename_functor(name.c_str(), options, true)), call) ;
+    return true ;
+  }
+} ;
+
+bool pl2r_fast(PlTerm pl, RObject& r, List options)
+{
+  RlConversion c(rolog_stats.pl2r, pl2r_kind(pl)) ;
+  size_t len ;
+  char* rec = PL_record_external(pl.C_, &len) ;
+  if(rec == NULL)
+  {
+    PL_clear_exception() ;
+    return false ;
+  }
+
+  std::unique_ptr<char, int (*)(char*)> guard(rec, PL_erase_external) ;
+  RlRecordReader reader(rec, len, options) ;
+  return reader.record(r) ;
+}
+
+// Check the decoder once against pl2r
+static bool fast_records()
+{
+  static int ok = -1 ;
+  if(ok >= 0)
+    return ok ;
+
+  ok = 0 ;
+  List options = List::create(Named("realvec") = "##", Named("realmat") = "###",
+    Named("boolvec") = "!!", Named("boolmat") = "!!!",
+    Named("charvec") = "$$", Named("charmat") = "$$$",
+    Named("intvec") = "%%", Named("intmat") = "%%%",
+    Named("atomize") = false, Named("scalar") = true,
+    Named("codecs") = false, Named("rewrite") = false) ;
+
+  fid_t f = PL_open_foreign_frame() ;
+  PlTerm_var t ;
+  if(PL_chars_to_term(
+       "p([1, -7, 300, 70000, -2147483647], [1.5, -0.0, 1.0e300, 0.1],"
+       "  [\"\", \"ab\", \"abcdefg\", \"abcdefgh\", \"abcdefghijklmnopq\"],"
+       "  [a-1, 'b c'-[], []-2, f(x=k, []=1), '[]', g(), 1-a, [x]],"
+       "  '##'(1.0, 2, na), '%%'(1, na), '!!'(true, false, na),"
+       "  '$$'(\"a\", b, na), [[]], na, true, false)", t.C_))
+  {
+    CharacterVector names ;
+    PlTerm_var vars ;
+    RObject r ;
+    if(pl2r_fast(t, r, options))
+      ok = R_compute_identical(r, pl2r(t, names, vars, options), 16) ;
+  }
+
+  PL_discard_foreign_frame(f) ;
+  if(!ok)
+    warning("transfer = \"fast\" is not supported by this version of SWI-Prolog, using the default converters") ;
+
+  return ok ;
+}
+
+// Translations with the option transfer
+PlTerm r2pl_transfer(SEXP r, CharacterVector& names, PlTerm& vars, List options)
+{
+  PlTerm_var pl ;
+  if(option_fast(options) && r2pl_fast(r, pl, names, vars, options))
+    return pl ;
+
+  return r2pl(r, names, vars, options) ;
+}
+
+RObject pl2r_transfer(PlTerm pl, CharacterVector& names, PlTerm& vars, List options)
+{
+  RObject r ;
+  if(option_fast(options) && PL_is_compound(pl.C_) && PL_is_ground(pl.C_)
+     && fast_records() && pl2r_fast(pl, r, options))
+    return r ;
+
+  return pl2r(pl, names, vars, options) ;
+}
+
+// Streams
+//
+// A long R vector is translated to a lazy list whose elements are decoded in
+// chunks when the consumer advances (see freeze/2), so that the vector is
+// never on the prolog stack as a whole. The vector and the options are kept
+// in a blob. When the blob is garbage collected, possibly in another thread,
+// the R objects are queued and released by the next call of r2pl_stream.
+//
+struct RlStream
+{
+  SEXP x ;
+  SEXP options ;
+  R_xlen_t length ;
+} ;
+
+static std::mutex stream_mutex ;
+static std::vector<SEXP> stream_garbage ;
+
+static int release_stream(atom_t a)
+{
+  RlStream* s = *(RlStream**) PL_blob_data(a, NULL, NULL) ;
+  std::lock_guard<std::mutex> lock(stream_mutex) ;
+  stream_garbage.push_back(s->x) ;
+  stream_garbage.push_back(s->options) ;
+  delete s ;
+  return TRUE ;
+}
+
+static int write_stream(IOSTREAM* out, atom_t a, int flags)
+{
+  RlStream* s = *(RlStream**) PL_blob_data(a, NULL, NULL) ;
+  Sfprintf(out, "<r_stream>(%p,%lld)", (void*) s, (long long) s->length) ;
+  return TRUE ;
+}
+
+static PL_blob_t stream_blob =
+{
+  PL_BLOB_MAGIC, PL_BLOB_UNIQUE, (char*) "r_stream",
+  release_stream, NULL, write_stream, NULL
+} ;
+
+// The predicate r_stream_chunk_/4 is in module rolog in the pack
+#ifdef PROLOGPACK
+static const char* stream_module = "rolog" ;
+#else
+static const char* stream_module = "user" ;
+#endif
+
+// Element i of an R vector as a prolog scalar, see r2pl_real and the like.
+// Factors are translated to their labels.
+PlTerm r2pl_element(SEXP r, R_xlen_t i, CharacterVector& names, PlTerm& vars, List options)
+{
+  switch(TYPEOF(r))
+  {
+    case REALSXP:
+      if(ISNA(REAL(r)[i]))
+        return r2pl_na() ;
+      return PlTerm_float(REAL(r)[i]) ;
+
+    case INTSXP:
+      if(INTEGER(r)[i] == NA_INTEGER)
+        return r2pl_na() ;
+      if(Rf_isFactor(r))
+        return PlTerm_string(Rf_translateCharUTF8(STRING_ELT(Rf_getAttrib(r, R_LevelsSymbol), INTEGER(r)[i] - 1))) ;
+      return PlTerm_integer(INTEGER(r)[i]) ;
+
+    case LGLSXP:
+      if(LOGICAL(r)[i] == NA_LOGICAL)
+        return r2pl_na() ;
+      return PlTerm_atom(LOGICAL(r)[i] ? "true" : "false") ;
+
+    case STRSXP:
+      if(STRING_ELT(r, i) == NA_STRING)
+        return r2pl_na() ;
+      return PlTerm_string(Rf_translateCharUTF8(STRING_ELT(r, i))) ;
+
+    case VECSXP:
+      return r2pl(VECTOR_ELT(r, i), names, vars, options) ;
+  }
+
+  return r2pl_na() ;
+}
+
+// freeze(List, with_mutex(rolog, r_stream_chunk_(Stream, Offset, Chunk, List)))
+static void stream_freeze(PlTerm stream, int64_t offset, int64_t chunk, PlTerm list)
+{
+  PlTermv args(4) ;
+  PlCheckFail(args[0].unify_term(stream)) ;
+  PlCheckFail(PL_unify_int64(args[1].C_, offset)) ;
+  PlCheckFail(PL_unify_int64(args[2].C_, chunk)) ;
+  PlCheckFail(args[3].unify_term(list)) ;
+  PlCompound next(":", PlTermv(PlTerm_atom(stream_module), PlCompound("r_stream_chunk_", args))) ;
+  PlCompound goal("with_mutex", PlTermv(PlTerm_atom("rolog"), next)) ;
+  PlCheckFail(PlCall("freeze", PlTermv(list, goal))) ;
+}
+
+PlTerm r2pl_stream(SEXP r, int64_t chunk, List options)
+{
+  {
+    std::lock_guard<std::mutex> lock(stream_mutex) ;
+    for(size_t i=0 ; i<stream_garbage.size() ; i++)
+      R_ReleaseObject(stream_garbage[i]) ;
+    stream_garbage.clear() ;
+  }
+
+  R_PreserveObject(r) ;
+  R_PreserveObject(options) ;
+  RlStream* s = new RlStream { r, options, Rf_xlength(r) } ;
+
+  PlTerm_var stream ;
+  PlCheckFail(PL_unify_blob(stream.C_, &s, sizeof(s), &stream_blob)) ;
+  PlTerm_var list ;
+  stream_freeze(stream, 0, chunk > 0 ? chunk : 1, list) ;
+  return list ;
+}
+
+// r_stream_chunk_(+Stream, +Offset, +Chunk, ?List)
+//
+// Unifies List with the next elements and a frozen tail for the rest
+PREDICATE(r_stream_chunk_, 4)
+{
+  void* data ;
+  size_t len ;
+  PL_blob_t* type ;
+  if(!PL_get_blob(A1.C_, &data, &len, &type) || type != &stream_blob)
+    throw PlTypeError("r_stream", A1) ;
+
+  RlStream* s = *(RlStream**) data ;
+  int64_t offset ;
+  int64_t chunk ;
+  PlCheckFail(PL_get_int64_ex(A2.C_, &offset)) ;
+  PlCheckFail(PL_get_int64_ex(A3.C_, &chunk)) ;
+  R_xlen_t end = std::min((R_xlen_t) (offset + chunk), s->length) ;
+
+  CharacterVector names ;
+  PlTerm_var vars ;
+  List options(s->options) ;
+  PlTerm_tail tail(A4) ;
+  for(R_xlen_t i=offset ; i<end ; i++)
+    if(!tail.append(r2pl_element(s->x, i, names, vars, options)))
+      return false ;
+
+  if(end >= s->length)
+    return tail.close() ;
+
+  stream_freeze(A1, end, chunk, tail) ;
+  return true ;
+}
+
+// Numeric kernels
+//
+// r_vec/3 and r_vec/4 compute sums, means, dot products and elementwise 
+// arithmetic directly on vectors like ##(1.0, 2.0, na) and %%(1, 2, 3),
+// without a round trip to R and without the mutex for R. Missing values
+// follow R: na propagates in sums and arithmetic, and is ignored by
+// which_max/which_min. Integer vectors give integer results where R does,
+// with na on integer overflow.
+//
+// The elementwise loops run over plain arrays, so that the compiler can
+// vectorize them. Sums are accumulated in long double, as in R's sum and mean,
+// to get the same results as R.
+//
+struct RlVec
+{
+  std::vector<double> x ;
+  bool integer ;
+} ;
+
+// Vector from ##(...), %%(...), a list of numbers or a single number
+static bool vec_get(PlTerm pl, RlVec& v)
+{
+  v.x.clear() ;
+  v.integer = true ;
+
+  PlTerm_var e ;
+  size_t len = 0 ;
+  bool list = PL_skip_list(pl.C_, 0, &len) == PL_LIST ;
+  if(list || pl.is_compound())
+  {
+    if(!list)
+    {
+      std::string name = pl.name().as_string() ;
+      if(name != "##" && name != "%%" && name != "#" && name != "%")
+        return false ;
+      if(name[0] == '#')
+        v.integer = false ;
+      len = pl.arity() ;
+    }
+
+    v.x.resize(len) ;
+    PlTerm_tail tail(pl) ;
+    for(size_t i=0 ; i<len ; i++)
+    {
+      if(list)
+        PlCheckFail(tail.next(e)) ;
+      else
+        PlCheckFail(PL_get_arg(i + 1, pl.C_, e.C_)) ;
+
+      int64_t n ;
+      if(e.is_integer() && PL_get_int64(e.C_, &n))
+        v.x[i] = (double) n ;
+      else if(e.is_float())
+      {
+        v.x[i] = e.as_float() ;
+        v.integer = false ;
+      }
+      else if(e.is_atom() && e.as_string() == "na")
+        v.x[i] = NA_REAL ;
+      else
+        return false ;
+    }
+
+    return true ;
+  }
+
+  int64_t n ;
+  if(pl.is_integer() && PL_get_int64(pl.C_, &n))
+  {
+    v.x.push_back((double) n) ;
+    return true ;
+  }
+
+  if(pl.is_float())
+  {
+    v.x.push_back(pl.as_float()) ;
+    v.integer = false ;
+    return true ;
+  }
+
+  if(pl.is_atom() && pl.as_string() == "na")
+  {
+    v.x.push_back(NA_REAL) ;
+    return true ;
+  }
+
+  return false ;
+}
+
+static PlTerm vec_scalar(double x, bool integer)
+{
+  if(ISNA(x))
+    return r2pl_na() ;
+
+  if(!integer)
+    return PlTerm_float(x) ;
+
+  PlTerm_var t ;
+  PlCheckFail(PL_put_int64(t.C_, (int64_t) x)) ;
+  return t ;
+}
+
+// Scalar for length 1, ##(...) or %%(...) otherwise, [] for empty vectors
+static PlTerm vec_put(const std::vector<double>& x, bool integer)
+{
+  if(x.empty())
+    return r2pl_null() ;
+
+  if(x.size() == 1)
+    return vec_scalar(x[0], integer) ;
+
+  PlTermv args(x.size()) ;
+  for(size_t i=0 ; i<x.size() ; i++)
+    PlCheckFail(args[i].unify_term(vec_scalar(x[i], integer))) ;
+  return PlCompound(integer ? "%%" : "##", args) ;
+}
+
+static bool vec_has_na(const std::vector<double>& x)
+{
+  for(size_t i=0 ; i<x.size() ; i++)
+    if(ISNA(x[i]))
+      return true ;
+  return false ;
+}
+
+// Integers outside R's range are NA
+static double vec_int(long double x)
+{
+  if(x > INT_MAX || x < -INT_MAX)
+    return NA_REAL ;
+  return (double) x ;
+}
+
+static double vec_sum(const RlVec& v)
+{
+  if(vec_has_na(v.x))
+    return NA_REAL ;
+
+  long double s = 0 ;
+  for(size_t i=0 ; i<v.x.size() ; i++)
+    s += v.x[i] ;
+
+  return v.integer ? vec_int(s) : (double) s ;
+}
+
+// Two passes as in R's mean
+static double vec_mean(const RlVec& v)
+{
+  size_t n = v.x.size() ;
+  if(n == 0)
+    return R_NaN ;
+
+  if(vec_has_na(v.x))
+    return NA_REAL ;
+
+  long double s = 0 ;
+  for(size_t i=0 ; i<n ; i++)
+    s += v.x[i] ;
+  s /= n ;
+
+  if(!v.integer && R_FINITE((double) s))
+  {
+    long double t = 0 ;
+    for(size_t i=0 ; i<n ; i++)
+      t += v.x[i] - s ;
+    s += t / n ;
+  }
+
+  return (double) s ;
+}
+
+static double vec_extreme(const RlVec& v, bool max)
+{
+  double m = max ? R_NegInf : R_PosInf ;
+  bool nan = false ;
+  for(size_t i=0 ; i<v.x.size() ; i++)
+  {
+    if(ISNA(v.x[i]))
+      return NA_REAL ;
+
+    if(ISNAN(v.x[i]))
+      nan = true ;
+    else if(max ? v.x[i] > m : v.x[i] < m)
+      m = v.x[i] ;
+  }
+
+  return nan ? R_NaN : m ;
+}
+
+// 1-based index of the first maximum (minimum), NA and NaN are ignored
+static std::vector<double> vec_which(const RlVec& v, bool max)
+{
+  std::vector<double> r ;
+  for(size_t i=0 ; i<v.x.size() ; i++)
+  {
+    if(ISNAN(v.x[i]))
+      continue ;
+
+    if(r.empty() || (max ? v.x[i] > v.x[(size_t) r[0] - 1] : v.x[i] < v.x[(size_t) r[0] - 1]))
+      r.assign(1, (double) (i + 1)) ;
+  }
+
+  return r ;
+}
+
+static std::vector<double> vec_cumsum(const RlVec& v)
+{
+  std::vector<double> r(v.x.size(), NA_REAL) ;
+  long double s = 0 ;
+  for(size_t i=0 ; i<v.x.size() ; i++)
+  {
+    if(ISNA(v.x[i]))
+      break ;
+
+    s += v.x[i] ;
+    r[i] = v.integer ? vec_int(s) : (double) s ;
+    if(ISNA(r[i]))
+      break ;
+  }
+
+  return r ;
+}
+
+// Elementwise arithmetic with recycling of the shorter vector
+static std::vector<double> vec_arith(char op, const RlVec& a, const RlVec& b, bool integer)
+{
+  size_t na = a.x.size() ;
+  size_t nb = b.x.size() ;
+  size_t n = na && nb ? std::max(na, nb) : 0 ;
+  std::vector<double> r(n) ;
+  const double* x = a.x.data() ;
+  const double* y = b.x.data() ;
+  double* z = r.data() ;
+
+  if(na == n && nb == n)
+  {
+    switch(op)
+    {
+      case '+': for(size_t i=0 ; i<n ; i++) z[i] = x[i] + y[i] ; break ;
+      case '-': for(size_t i=0 ; i<n ; i++) z[i] = x[i] - y[i] ; break ;
+      case '*': for(size_t i=0 ; i<n ; i++) z[i] = x[i] * y[i] ; break ;
+      case '/': for(size_t i=0 ; i<n ; i++) z[i] = x[i] / y[i] ; break ;
+    }
+  }
+  else
+  {
+    for(size_t i=0 ; i<n ; i++)
+    {
+      double u = x[i % na] ;
+      double w = y[i % nb] ;
+      z[i] = op == '+' ? u + w : op == '-' ? u - w : op == '*' ? u * w : u / w ;
+    }
+  }
+
+  // NA + NaN may be NaN on some platforms, R keeps NA
+  for(size_t i=0 ; i<n ; i++)
+  {
+    if(ISNAN(z[i]) && (ISNA(x[i % na]) || ISNA(y[i % nb])))
+      z[i] = NA_REAL ;
+    else if(integer)
+      z[i] = vec_int(z[i]) ;
+  }
+
+  return r ;
+}
+
+static RlVec vec_arg(PlTerm pl)
+{
+  RlVec v ;
+  if(!vec_get(pl, v))
+    throw PlTypeError("r_vector", pl) ;
+  return v ;
+}
+
+// r_vec(+Op, +Vector, -Result), Op is sum, mean, min, max, cumsum, which_max
+// or which_min
+PREDICATE(r_vec, 3)
+{
+  std::string op = A1.as_string() ;
+  RlVec v = vec_arg(A2) ;
+
+  if(op == "sum")
+    return A3.unify_term(vec_scalar(vec_sum(v), v.integer)) ;
+
+  if(op == "mean")
+    return A3.unify_term(vec_scalar(vec_mean(v), false)) ;
+
+  if(op == "min" || op == "max")
+    return A3.unify_term(vec_scalar(vec_extreme(v, op == "max"), v.integer && v.x.size())) ;
+
+  if(op == "cumsum")
+    return A3.unify_term(vec_put(vec_cumsum(v), v.integer)) ;
+
+  if(op == "which_max" || op == "which_min")
+    return A3.unify_term(vec_put(vec_which(v, op == "which_max"), true)) ;
+
+  throw PlDomainError("r_vec_operation", A1) ;
+}
+
+// r_vec(+Op, +Vector1, +Vector2, -Result), Op is +, -, *, / or dot
+PREDICATE(r_vec, 4)
+{
+  std::string op = A1.as_string() ;
+  RlVec a = vec_arg(A2) ;
+  RlVec b = vec_arg(A3) ;
+  bool integer = a.integer && b.integer ;
+
+  if(op == "dot")
+  {
+    RlVec p ;
+    p.x = vec_arith('*', a, b, false) ;
+    p.integer = integer ;
+    return A4.unify_term(vec_scalar(vec_sum(p), integer)) ;
+  }
+
+  if(op == "+" || op == "-" || op == "*")
+    return A4.unify_term(vec_put(vec_arith(op[0], a, b, integer), integer)) ;
+
+  if(op == "/")
+    return A4.unify_term(vec_put(vec_arith('/', a, b, false), false)) ;
+
+  throw PlDomainError("r_vec_operation", A1) ;
+}
+
+// Interval arithmetic
+//
+// r_interval/4 implements +, -, * and / of inst/pl/interval.pl (Hickey et
+// al., Figures 3 and 4) for intervals of floats, with the same case analysis
+// and the same order of the cases. The bounds are rounded outwards: a lower
+// bound is moved to the next smaller float if the exact result is below the
+// rounded one, and the upper bound likewise. The rounding error is obtained
+// from error-free transformations (TwoSum, fma), so exact results are not
+// widened.
+//
+// Besides scalar intervals L ... U, the bounds can be vectors ##(...),
+// and the operation is applied elementwise.
+//
+struct RlInterval
+{
+  double l ;
+  double u ;
+} ;
+
+// Prolog's 0.0 does not match -0.0
+static bool pos_zero(double x)
+{
+  return x == 0.0 && !std::signbit(x) ;
+}
+
+// Sign classes, see interval.pl
+static bool iv_zero(double l, double u) { return pos_zero(l) && pos_zero(u) ; }
+static bool iv_mixed(double l, double u) { return l < 0 && u > 0 ; }
+static bool iv_positive(double l, double u) { return l >= 0 && u > 0 ; }
+static bool iv_zeropos(double l, double u) { return pos_zero(l) && u > 0 ; }
+static bool iv_strictpos(double l, double) { return l > 0 ; }
+static bool iv_negative(double l, double u) { return l < 0 && u <= 0 ; }
+static bool iv_zeroneg(double l, double u) { return l < 0 && pos_zero(u) ; }
+static bool iv_strictneg(double, double u) { return u < 0 ; }
+
+// Next float in the direction of the rounding error
+static double round_dn(double x, double err)
+{
+  return std::isfinite(x) && err < 0 ? std::nextafter(x, -INFINITY) : x ;
+}
+
+static double round_up(double x, double err)
+{
+  return std::isfinite(x) && err > 0 ? std::nextafter(x, INFINITY) : x ;
+}
+
+// TwoSum
+static double add_err(double a, double b, double s)
+{
+  double bb = s - a ;
+  return (a - (s - bb)) + (b - bb) ;
+}
+
+// The exact quotient minus q has the sign of (a - q*b)/b
+static double div_err(double a, double b, double q)
+{
+  double r = std::fma(-q, b, a) ;
+  return b > 0 ? r : -r ;
+}
+
+static double add_dn(double a, double b) { double s = a + b ; return round_dn(s, add_err(a, b, s)) ; }
+static double add_up(double a, double b) { double s = a + b ; return round_up(s, add_err(a, b, s)) ; }
+static double mul_dn(double a, double b) { double p = a * b ; return round_dn(p, std::fma(a, b, -p)) ; }
+static double mul_up(double a, double b) { double p = a * b ; return round_up(p, std::fma(a, b, -p)) ; }
+static double div_dn(double a, double b) { double q = a / b ; return round_dn(q, div_err(a, b, q)) ; }
+static double div_up(double a, double b) { double q = a / b ; return round_up(q, div_err(a, b, q)) ; }
+
+// Number of resulting intervals: 0 if no case applies, 2 for some divisions
+// by mixed intervals, 1 otherwise
+static int interval_op(char op, RlInterval x, RlInterval y, RlInterval r[2])
+{
+  double A = x.l, B = x.u, C = y.l, D = y.u ;
+  const double inf = INFINITY ;
+  if(ISNAN(A) || ISNAN(B) || ISNAN(C) || ISNAN(D))
+    return 0 ;
+
+  if(op == '+')
+  {
+    r[0] = { add_dn(A, C), add_up(B, D) } ;
+    return 1 ;
+  }
+
+  if(op == '-')
+  {
+    r[0] = { add_dn(A, -D), add_up(B, -C) } ;
+    return 1 ;
+  }
+
+  if(op == '*')
+  {
+    if(iv_zero(A, B) || iv_zero(C, D))
+      r[0] = { 0.0, 0.0 } ;
+    else if(iv_positive(A, B) && iv_positive(C, D))
+      r[0] = { mul_dn(A, C), mul_up(B, D) } ;
+    else if(iv_positive(A, B) && iv_mixed(C, D))
+      r[0] = { mul_dn(B, C), mul_up(B, D) } ;
+    else if(iv_positive(A, B) && iv_negative(C, D))
+      r[0] = { mul_dn(B, C), mul_up(A, D) } ;
+    else if(iv_mixed(A, B) && iv_positive(C, D))
+      r[0] = { mul_dn(A, D), mul_up(B, D) } ;
+    else if(iv_mixed(A, B) && iv_mixed(C, D))
+      r[0] = { std::min(mul_dn(A, D), mul_dn(B, C)), std::max(mul_up(A, C), mul_up(B, D)) } ;
+    else if(iv_mixed(A, B) && iv_negative(C, D))
+      r[0] = { mul_dn(B, C), mul_up(A, C) } ;
+    else if(iv_negative(A, B) && iv_positive(C, D))
+      r[0] = { mul_dn(A, D), mul_up(B, C) } ;
+    else if(iv_negative(A, B) && iv_mixed(C, D))
+      r[0] = { mul_dn(A, D), mul_up(A, C) } ;
+    else if(iv_negative(A, B) && iv_negative(C, D))
+      r[0] = { mul_dn(B, D), mul_up(A, C) } ;
+    else
+      return 0 ;
+    return 1 ;
+  }
+
+  if(op != '/')
+    return 0 ;
+
+  // Denominator P, special case C = 0.0 first
+  if(iv_strictpos(A, B) && pos_zero(C) && D > 0)
+    r[0] = { div_dn(A, D), inf } ;
+  else if(iv_strictpos(A, B) && iv_positive(C, D))
+    r[0] = { div_dn(A, D), div_up(B, C) } ;
+  else if(iv_zeropos(A, B) && pos_zero(C) && D > 0)
+    r[0] = { 0.0, inf } ;
+  else if(iv_zeropos(A, B) && iv_positive(C, D))
+    r[0] = { 0.0, div_up(B, C) } ;
+  else if(iv_mixed(A, B) && pos_zero(C) && D > 0)
+    r[0] = { -inf, inf } ;
+  else if(iv_mixed(A, B) && iv_positive(C, D))
+    r[0] = { div_dn(A, C), div_up(B, C) } ;
+  else if(iv_zeroneg(A, B) && pos_zero(C) && D > 0)
+    r[0] = { -inf, 0.0 } ;
+  else if(iv_zeroneg(A, B) && iv_positive(C, D))
+    r[0] = { div_dn(A, C), 0.0 } ;
+  else if(iv_strictneg(A, B) && pos_zero(C) && D > 0)
+    r[0] = { -inf, div_up(B, D) } ;
+  else if(iv_strictneg(A, B) && iv_positive(C, D))
+    r[0] = { div_dn(A, C), div_up(B, D) } ;
+
+  // Denominator M
+  else if(iv_strictpos(A, B) && iv_mixed(C, D))
+  {
+    r[0] = { -inf, div_up(A, C) } ;
+    r[1] = { div_dn(A, D), inf } ;
+    return 2 ;
+  }
+  else if((iv_zeropos(A, B) || iv_mixed(A, B) || iv_zeroneg(A, B)) && iv_mixed(C, D))
+    r[0] = { -inf, inf } ;
+  else if(iv_strictneg(A, B) && iv_mixed(C, D))
+  {
+    r[0] = { -inf, div_up(B, D) } ;
+    r[1] = { div_dn(B, C), inf } ;
+    return 2 ;
+  }
+
+  // Denominator N, special case D = 0.0 first
+  else if(iv_strictpos(A, B) && pos_zero(D) && C < 0)
+    r[0] = { -inf, div_up(A, C) } ;
+  else if(iv_strictpos(A, B) && iv_negative(C, D))
+    r[0] = { div_dn(B, D), div_up(A, C) } ;
+  else if(iv_zeropos(A, B) && pos_zero(D) && C < 0)
+    r[0] = { -inf, 0.0 } ;
+  else if(iv_zeropos(A, B) && iv_negative(C, D))
+    r[0] = { div_dn(B, D), 0.0 } ;
+  else if(iv_mixed(A, B) && pos_zero(D) && C < 0)
+    r[0] = { -inf, inf } ;
+  else if(iv_mixed(A, B) && iv_negative(C, D))
+    r[0] = { div_dn(B, D), div_up(A, D) } ;
+  else if(iv_zeroneg(A, B) && pos_zero(D) && C < 0)
+    r[0] = { 0.0, inf } ;
+  else if(iv_zeroneg(A, B) && iv_negative(C, D))
+    r[0] = { 0.0, div_up(A, D) } ;
+  else if(iv_strictneg(A, B) && pos_zero(D) && C < 0)
+    r[0] = { div_dn(B, C), inf } ;
+  else if(iv_strictneg(A, B) && iv_negative(C, D))
+    r[0] = { div_dn(B, C), div_up(A, D) } ;
+  else
+    return 0 ;
+
+  return 1 ;
+}
+
+// Bounds of L ... U, each a number or a vector
+static bool interval_get(PlTerm pl, RlVec& l, RlVec& u, bool& vector)
+{
+  if(!pl.is_compound() || pl.name().as_string() != "..." || pl.arity() != 2)
+    return false ;
+
+  PlTerm a = pl[1] ;
+  PlTerm b = pl[2] ;
+  if(!vec_get(a, l) || !vec_get(b, u) || l.x.size() != u.x.size())
+    return false ;
+
+  if(!a.is_number() || !b.is_number())
+    vector = true ;
+  return true ;
+}
+
+static PlTerm interval_put(RlInterval r)
+{
+  return PlCompound("...", PlTermv(PlTerm_float(r.l), PlTerm_float(r.u))) ;
+}
+
+// r_interval(+Op, +X, +Y, -Res), Op is +, -, * or /
+//
+// For scalar intervals, Res is L ... U, or a list of two intervals for the
+// divisions by mixed intervals. For vectors, Res is ##(L1, ...) ... ##(U1,
+// ...), with the hull -Inf ... Inf for the divisions with two intervals and
+// na if no case applies.
+PREDICATE(r_interval, 4)
+{
+  std::string op = A1.as_string() ;
+  if(op.size() != 1 || !strchr("+-*/", op[0]))
+    throw PlDomainError("interval_operation", A1) ;
+
+  RlVec xl, xu, yl, yu ;
+  bool vector = false ;
+  if(!interval_get(A2, xl, xu, vector))
+    throw PlTypeError("interval", A2) ;
+  if(!interval_get(A3, yl, yu, vector))
+    throw PlTypeError("interval", A3) ;
+
+  RlInterval r[2] ;
+  if(!vector)
+  {
+    int n = interval_op(op[0], { xl.x[0], xu.x[0] }, { yl.x[0], yu.x[0] }, r) ;
+    if(n == 0)
+      return false ;
+
+    if(n == 1)
+      return A4.unify_term(interval_put(r[0])) ;
+
+    PlTerm_var l ;
+    PlTerm_tail tail(l) ;
+    PlCheckFail(tail.append(interval_put(r[0]))) ;
+    PlCheckFail(tail.append(interval_put(r[1]))) ;
+    PlCheckFail(tail.close()) ;
+    return A4.unify_term(l) ;
+  }
+
+  size_t nx = xl.x.size() ;
+  size_t ny = yl.x.size() ;
+  size_t len = nx && ny ? std::max(nx, ny) : 0 ;
+  std::vector<double> l(len) ;
+  std::vector<double> u(len) ;
+  for(size_t i=0 ; i<len ; i++)
+  {
+    int n = interval_op(op[0], { xl.x[i % nx], xu.x[i % nx] }, { yl.x[i % ny], yu.x[i % ny] }, r) ;
+    l[i] = n == 0 ? NA_REAL : n == 1 ? r[0].l : std::min(r[0].l, r[1].l) ;
+    u[i] = n == 0 ? NA_REAL : n == 1 ? r[0].u : std::max(r[0].u, r[1].u) ;
+  }
+
+  return A4.unify_term(PlCompound("...", PlTermv(vec_put(l, false), vec_put(u, false)))) ;
+}
+
+#ifdef RPACKAGE
+
+#include <R_ext/Altrep.h>
+
+class RlQuery
+{
+  CharacterVector names ;
+  PlTerm_var vars ;
+  List options ;
+  Environment env ;
+  PlQuery* qid ;
+  unsigned long long solutions ;
+
+  // s(Inferences0, Stack, Inferences), sampled by the goal itself, see the
+  // constructor. The arguments are set with nb_setarg/3, so that they survive
+  // backtracking.
+  PlTerm_var sample ;
+  unsigned long long stack_peak ;
+  unsigned long long sampled(int i) ;
+
+  // Budgets, see the options timeout, inferences and stack_limit
+  double inference_limit ;
+  PlTerm_var limit_result ;
+  double timeout ;
+  std::chrono::steady_clock::time_point deadline ;
+  int64_t old_stack_limit ;
+  std::string status ;
+
+  // Aggregation, deduplication and ordering in prolog, see findall
+  PlTerm variable(const char* name) ;
+  PlTerm variables(CharacterVector skip) ;
+  term_t pushdown(term_t goal) ;
+
+public:
+  RlQuery(RObject aquery, List aoptions, Environment aenv) ;
+  ~RlQuery() ;
+
+  int next_solution() ;
+
+  List bindings(RObject select) ;
+
+  const List& get_options() const
+  {
+    return options ;
+  }
+
+  Environment& get_env()
+  {
+    return env ;
+  }
+
+  // Empty or the reason why the query was stopped early: timeout, inferences,
+  // stack_limit or interrupt
+  const std::string& get_status() const
+  {
+    return status ;
+  }
+} ;
+
+// Poll R's user interrupt without a longjmp out of the C++ code
+static void check_interrupt(void*)
+{
+  R_CheckUserInterrupt() ;
+}
+
+static bool user_interrupt()
+{
+  return R_ToplevelExec(check_interrupt, NULL) == FALSE ;
+}
+
+// Exceptions raised by the budgets
+static std::string limit_exceeded(PlException& ex)
+{
+  PlTerm e = ex.term() ;
+  if(e.is_atom() && e.as_string() == "time_limit_exceeded")
+    return "timeout" ;
+
+  if(e.is_atom() && e.as_string() == "rolog_interrupt")
+    return "interrupt" ;
+
+  // Stack overflows only, other resource errors (e.g., memory) are errors
+  if(e.is_compound() && e.name().as_string() == "error" && e.arity() == 2)
+  {
+    PlTerm formal = e[1] ;
+    if(formal.is_compound() && formal.name().as_string() == "resource_error"
+       && formal.arity() == 1 && formal[1].is_atom())
+    {
+      std::string what = formal[1].as_string() ;
+      if(what == "stack_overflow" || what == "global_stack" || what == "local_stack"
+         || what == "trail_stack" || what == "stack")
+        return "stack_limit" ;
+    }
+  }
+
+  return "" ;
+}
+
+// Watchdog of the running query
+//
+// While prolog searches for the next solution, an alarm calls the foreign
+// predicate rolog_watchdog/0 every 0.2 s, or at the deadline of the option
+// timeout if that comes earlier. The watchdog throws time_limit_exceeded at
+// the deadline and rolog_interrupt if the user has pressed Ctrl-C in R, so
+// that a long search for a single solution can be stopped. Otherwise, it
+// installs the alarm for the next check. The alarm is removed before control
+// is back in R. A nested query (e.g., from R called by prolog) runs under the
+// watchdog of the outer query. The id of the pending alarm is recorded,
+// because term references do not survive the call of next_solution.
+struct RlWatchdog
+{
+  bool active ;
+  bool timed ;
+  std::chrono::steady_clock::time_point deadline ;
+  record_t alarm ;
+} ;
+
+static RlWatchdog watchdog = { false, false, std::chrono::steady_clock::time_point(), 0 } ;
+static const double watchdog_interval = 0.2 ;
+
+// library(time) is only loaded when the first query runs
+static bool time_loaded = false ;
+
+// This is also called from the alarm, so that it reports errors by return
+// value and not by C++ exceptions
+static bool watchdog_arm()
+{
+  double wait = watchdog_interval ;
+  if(watchdog.timed)
+    wait = std::max(0.0, std::min(wait,
+      std::chrono::duration<double>(watchdog.deadline - std::chrono::steady_clock::now()).count())) ;
+
+  fid_t f = PL_open_foreign_frame() ;
+  term_t av = PL_new_term_refs(4) ;
+  bool ok = PL_put_float(av, wait)
+    && PL_put_atom_chars(av + 1, "rolog_watchdog")
+    && PL_chars_to_term("[remove(true)]", av + 3)
+    && PL_call_predicate(NULL, PL_Q_PASS_EXCEPTION, PL_predicate("alarm", 4, "time"), av) ;
+  if(ok)
+    watchdog.alarm = PL_record(av + 2) ;
+  PL_close_foreign_frame(f) ;
+  return ok ;
+}
+
+static foreign_t rolog_watchdog()
+{
+  // The alarm has fired and is removed
+  if(watchdog.alarm)
+  {
+    PL_erase(watchdog.alarm) ;
+    watchdog.alarm = 0 ;
+  }
+
+  // Signal of an alarm that is already disarmed
+  if(!watchdog.active)
+    return TRUE ;
+
+  const char* ball = NULL ;
+  if(watchdog.timed && std::chrono::steady_clock::now() >= watchdog.deadline)
+    ball = "time_limit_exceeded" ;
+  else if(user_interrupt())
+    ball = "rolog_interrupt" ;
+
+  if(ball)
+  {
+    term_t ex = PL_new_term_ref() ;
+    PL_put_atom_chars(ex, ball) ;
+    return PL_raise_exception(ex) ;
+  }
+
+  return watchdog_arm() ;
+}
+
+static void watchdog_start(bool timed, std::chrono::steady_clock::time_point deadline)
+{
+  if(!time_loaded)
+  {
+    PlCall("use_module(library(time))") ;
+    time_loaded = true ;
+  }
+
+  watchdog.active = true ;
+  watchdog.timed = timed ;
+  watchdog.deadline = deadline ;
+  if(!watchdog_arm())
+  {
+    watchdog.active = false ;
+    PL_clear_exception() ;
+    stop("next_solution: cannot install alarm") ;
+  }
+}
+
+// A check that fires in between is ignored, the solution has been found
+static void watchdog_stop()
+{
+  watchdog.active = false ;
+  if(!watchdog.alarm)
+    return ;
+
+  fid_t f = PL_open_foreign_frame() ;
+  term_t id = PL_new_term_ref() ;
+  if(PL_recorded(watchdog.alarm, id))
+    PL_call_predicate(NULL, PL_Q_CATCH_EXCEPTION, PL_predicate("remove_alarm", 1, "time"), id) ;
+  PL_clear_exception() ;
+  PL_close_foreign_frame(f) ;
+
+  if(watchdog.alarm)
+  {
+    PL_erase(watchdog.alarm) ;
+    watchdog.alarm = 0 ;
+  }
+}
+
+// Set the prolog flag stack_limit, return the previous value or 0 on failure
+static int64_t set_stack_limit(int64_t limit)
+{
+  PlFrame f ;
+  PlTerm_var v ;
+  int64_t old = 0 ;
+  try
+  {
+    if(!PlCall("current_prolog_flag", PlTermv(PlTerm_atom("stack_limit"), v)) || !PL_get_int64(v.C_, &old))
+      return 0 ;
+
+    PlCall("set_prolog_flag", PlTermv(PlTerm_atom("stack_limit"), pl_count(limit))) ;
+  }
+
+  catch(PlException& ex)
+  {
+    PL_clear_exception() ;
+    return 0 ;
+  }
+
+  return old ;
+}
+
+RlQuery::RlQuery(RObject aquery, List aoptions, Environment aenv)
+  : names(),
+    vars(),
+    options(aoptions),
+    env(aenv),
+    qid(NULL),
+    solutions(0),
+    sample(),
+    stack_peak(0),
+    inference_limit(option_limit(aoptions, "inferences")),
+    limit_result(),
+    timeout(option_limit(aoptions, "timeout")),
+    deadline(),
+    old_stack_limit(0),
+    status()
+{
+  RlTimer t(rolog_stats.open) ;
+  RlSpanTimer span("query_", "query") ;
+  options("atomize") = false ;
+  RlSpanTimer conv("r2pl", "query") ;
+  PlTerm pl = r2pl_transfer(aquery, names, vars, options) ;
+  conv.stop() ;
+  term_t goal = pushdown(pl.C_) ;
+
+  // Inferences per solution, see call_with_inference_limit/3. The total is
+  // checked between the solutions.
+  if(inference_limit > 0)
+  {
+    PlTerm_var w ;
+    PlCheckFail(PL_chars_to_term("G-L-R-call_with_inference_limit(G, L, R)", w.C_)) ;
+    PlCheckFail(w[1][1][1].unify_term(PlTerm(goal))) ;
+    PlCheckFail(w[1][1][2].unify_term(pl_count((unsigned long long) inference_limit))) ;
+    PlCheckFail(w[1][2].unify_term(limit_result)) ;
+    goal = w[2].C_ ;
+  }
+
+  // Statistics from within the query, so that no extra call is needed when
+  // the query is opened and after each solution. The stack is sampled at
+  // each solution for the high-water mark.
+  PlTerm_var w ;
+  PlCheckFail(PL_chars_to_term(
+    "G-S-( statistics(inferences, I0), nb_setarg(1, S, I0), G,"
+    "      statistics(stack, St), nb_setarg(2, S, St),"
+    "      statistics(inferences, I), nb_setarg(3, S, I) )", w.C_)) ;
+  PlCheckFail(w[1][1].unify_term(PlTerm(goal))) ;
+  PlCheckFail(sample.unify_term(PlCompound("s", PlTermv(PlTerm_integer(0), PlTerm_integer(0), PlTerm_integer(0))))) ;
+  PlCheckFail(w[1][2].unify_term(sample)) ;
+  goal = w[2].C_ ;
+
+  // Deadline for the whole query, see next_solution
+  if(timeout > 0)
+    deadline = std::chrono::steady_clock::now() + 
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeout)) ;
+
+  // Stack limit in bytes, restored when the query is closed
+  double stack = option_limit(options, "stack_limit") ;
+  if(stack > 0)
+    old_stack_limit = set_stack_limit((int64_t) stack) ;
+
+  qid = new PlQuery("call", PlTermv(PlTerm(goal))) ;
+}
+
+unsigned long long RlQuery::sampled(int i)
+{
+  int64_t v = 0 ;
+  term_t a = PL_new_term_ref() ;
+  if(!PL_get_arg(i, sample.C_, a) || !PL_get_int64(a, &v))
+    v = 0 ;
+  PL_reset_term_refs(a) ;
+  return (unsigned long long) v ;
+}
+
+// Variable of the query with the given R name
+PlTerm RlQuery::variable(const char* name)
+{
+  PlTerm_tail tail(vars) ;
+  PlTerm_var v ;
+  for(R_xlen_t i=0 ; i<names.length() ; i++)
+  {
+    PlCheckFail(tail.next(v)) ;
+    if(names(i) == name)
+      return v ;
+  }
+
+  stop("findall: %s is not a variable of the query", name) ;
+}
+
+// Closed list with the variables of the query, except the ones in skip
+PlTerm RlQuery::variables(CharacterVector skip)
+{
+  PlTerm_var l ;
+  PlTerm_tail out(l) ;
+  PlTerm_tail tail(vars) ;
+  PlTerm_var v ;
+  for(R_xlen_t i=0 ; i<names.length() ; i++)
+  {
+    PlCheckFail(tail.next(v)) ;
+
+    bool found = false ;
+    for(R_xlen_t j=0 ; j<skip.length() && !found ; j++)
+      found = names(i) == skip(j) ;
+
+    if(!found)
+      PlCheckFail(out.append(v)) ;
+  }
+
+  PlCheckFail(out.close()) ;
+  return l ;
+}
+
+// Wrap the goal, so that the solutions are deduplicated, aggregated and 
+// ordered in prolog instead of R. Only the final rows are translated to R.
+//
+// distinct: distinct(Vars, G), with all variables of the query
+// aggregate: aggregate_all(r(count, sum(X)), G, r(N, S)), the aggregates are
+//   new variables with the names of the list elements
+// by: aggregate(r(count, sum(X)), Other^G, r(N, S)), one row per group
+// order_by: order_by([asc(Y), desc(N)], G), "-N" is descending
+//
+term_t RlQuery::pushdown(term_t goal)
+{
+  if(option_true(options, "distinct"))
+  {
+    PlCall("use_module(library(solution_sequences))") ;
+    PlTerm_var w ;
+    PlCheckFail(PL_chars_to_term("G-V-distinct(V, G)", w.C_)) ;
+    PlCheckFail(w[1][1].unify_term(PlTerm(goal))) ;
+    PlCheckFail(w[1][2].unify_term(variables(CharacterVector(0)))) ;
+    goal = w[2].C_ ;
+  }
+
+  if(options.containsElementNamed("aggregate") && !Rf_isNull(options["aggregate"]))
+  {
+    List agg = as<List>(options["aggregate"]) ;
+    CharacterVector an = agg.names() ;
+    CharacterVector by ;
+    if(options.containsElementNamed("by") && !Rf_isNull(options["by"]))
+      by = as<CharacterVector>(options["by"]) ;
+
+    // Quantify the other variables before the aggregates are added
+    for(R_xlen_t i=0 ; i<by.length() ; i++)
+      variable(by(i)) ;
+    PlTerm other = variables(by) ;
+
+    PlTermv tv(agg.size()) ;
+    PlTermv rv(agg.size()) ;
+    for(R_xlen_t i=0 ; i<agg.size() ; i++)
+    {
+      for(R_xlen_t j=0 ; j<names.length() ; j++)
+        if(names(j) == an(i))
+          stop("findall: aggregate %s is also a variable of the query", (const char*) an(i)) ;
+
+      // count() -> count
+      SEXP a = agg(i) ;
+      if(TYPEOF(a) == LANGSXP && Rf_length(a) == 1 && TYPEOF(CAR(a)) == SYMSXP)
+        PlCheckFail(tv[i].unify_term(PlTerm_atom(CHAR(PRINTNAME(CAR(a)))))) ;
+      else
+        PlCheckFail(tv[i].unify_term(r2pl(a, names, vars, options))) ;
+      PlCheckFail(rv[i].unify_term(r2pl_varname(Symbol((const char*) an(i)), names, vars, options))) ;
+    }
+
+    PlTerm_var t ;
+    PlTerm_var r ;
+    if(agg.size() == 1)
+    {
+      PlCheckFail(t.unify_term(tv[0])) ;
+      PlCheckFail(r.unify_term(rv[0])) ;
+    }
+    else
+    {
+      PlCheckFail(t.unify_term(PlCompound("r", tv))) ;
+      PlCheckFail(r.unify_term(PlCompound("r", rv))) ;
+    }
+
+    PlCall("use_module(library(aggregate))") ;
+    PlTerm_var w ;
+    if(by.length())
+    {
+      PlCheckFail(PL_chars_to_term("G-E-T-R-aggregate(T, E^G, R)", w.C_)) ;
+      PlCheckFail(w[1][1][1][1].unify_term(PlTerm(goal))) ;
+      PlCheckFail(w[1][1][1][2].unify_term(other)) ;
+    }
+    else
+    {
+      PlCheckFail(PL_chars_to_term("G-T-R-aggregate_all(T, G, R)", w.C_)) ;
+      PlCheckFail(w[1][1][1].unify_term(PlTerm(goal))) ;
+    }
+
+    PlCheckFail(w[1][1][2].unify_term(t)) ;
+    PlCheckFail(w[1][2].unify_term(r)) ;
+    goal = w[2].C_ ;
+  }
+
+  if(options.containsElementNamed("order_by") && !Rf_isNull(options["order_by"]))
+  {
+    CharacterVector ob = as<CharacterVector>(options["order_by"]) ;
+    PlTerm_var spec ;
+    PlTerm_tail tail(spec) ;
+    for(R_xlen_t i=0 ; i<ob.length() ; i++)
+    {
+      const char* name = ob(i) ;
+      if(name[0] == '-')
+        PlCheckFail(tail.append(PlCompound("desc", PlTermv(variable(name + 1))))) ;
+      else
+        PlCheckFail(tail.append(PlCompound("asc", PlTermv(variable(name))))) ;
+    }
+    PlCheckFail(tail.close()) ;
+
+    PlCall("use_module(library(solution_sequences))") ;
+    PlTerm_var w ;
+    PlCheckFail(PL_chars_to_term("G-S-order_by(S, G)", w.C_)) ;
+    PlCheckFail(w[1][1].unify_term(PlTerm(goal))) ;
+    PlCheckFail(w[1][2].unify_term(spec)) ;
+    goal = w[2].C_ ;
+  }
+
+  return goal ;
+}
+
+RlQuery::~RlQuery()
+{
+  RlTimer t(rolog_stats.close) ;
+  RlSpanTimer span("close", "query") ;
+
+  // Destructors must not throw, errors are reported on the console
+  try
+  {
+    // Highest stack usage at the solutions of the query
+    atomic_max(rolog_stats.max_stack, stack_peak) ;
+
+    // The only call of statistics/2 from outside the query, because the
+    // inferences after the last solution are not sampled
+    unsigned long long i0 = sampled(1) ;
+    if(i0)
+    {
+      unsigned long long n = pl_statistics("inferences") - i0 ;
+      rolog_stats.inferences.fetch_add(n, std::memory_order_relaxed) ;
+      atomic_max(rolog_stats.max_inferences, n) ;
+    }
+  }
+
+  catch(PlException& ex)
+  {
+    REprintf("rolog: %s\n", ex.as_string(PlEncoding::Locale).c_str()) ;
+    PL_clear_exception() ;
+  }
+
+  if(qid)
+    delete qid ;
+
+  if(old_stack_limit)
+    set_stack_limit(old_stack_limit) ;
+
+  rolog_stats.solutions.fetch_add(solutions, std::memory_order_relaxed) ;
+  atomic_max(rolog_stats.max_solutions, solutions) ;
+}
+
+int RlQuery::next_solution()
+{
+  if(qid == NULL)
+    stop("next_solution: no open query.") ;
+
+  // Budget exhausted before
+  if(!status.empty())
+    return 0 ;
+
+  if(user_interrupt())
+  {
+    status = "interrupt" ;
+    return 0 ;
+  }
+
+  if(timeout > 0 && std::chrono::steady_clock::now() >= deadline)
+  {
+    status = "timeout" ;
+    return 0 ;
+  }
+
+  if(inference_limit > 0 && solutions && sampled(3) - sampled(1) >= inference_limit)
+  {
+    status = "inferences" ;
+    return 0 ;
+  }
+
+  // Timeout and user interrupts during the search, see RlWatchdog
+  bool watch = !watchdog.active ;
+  if(watch)
+    watchdog_start(timeout > 0, deadline) ;
+
+  int q ;
+  try
+  {
+    RlTimer t(rolog_stats.next) ;
+    RlSpanTimer span("next_solution", "query") ;
+    q = qid->next_solution() ;
+  }
+
+  catch(PlException& ex)
+  {
+    status = limit_exceeded(ex) ;
+    std::string msg = status.empty() ? ex.as_string(PlEncoding::Locale) : "" ;
+    PL_clear_exception() ;
+    if(watch)
+      watchdog_stop() ;
+
+    if(!status.empty())
+      return 0 ;
+
+    warning(msg.c_str()) ;
+    stop("Query failed") ;
+  }
+
+  if(watch)
+    watchdog_stop() ;
+
+  if(q && inference_limit > 0 && limit_result.is_atom()
+     && limit_result.as_string() == "inference_limit_exceeded")
+  {
+    status = "inferences" ;
+    return 0 ;
+  }
+
+  if(q)
+  {
+    solutions++ ;
+    stack_peak = std::max(stack_peak, sampled(2)) ;
+  }
+
+  return q ;
+
+/*
+  int q = qid->next_solution() ;
+  if(q == PL_S_TRUE)
+    return true ;
+
+  if(q == PL_S_LAST)
+    return true ;
+
+  if(q == PL_S_FALSE)
+  {
+    PL_close_query(qid) ;
+    qid = 0 ;
+    return false ;
+  }
+
+  if(q == PL_S_EXCEPTION)
+  {
+    PL_close_query(qid) ;
+    qid = 0 ;
+
+    term_t ex = PL_exception(0) ;
+    char* err ;
+    if(PL_get_chars(ex, &err, BUF_DISCARDABLE|CVT_WRITE|REP_UTF8))
+    {
+      PL_clear_exception() ;
+      warning(err) ;
+      return false ;
+    }
+
+    PL_clear_exception() ;
+    warning("query: unknown exception occurred") ;
+    return false ;
+  }
+
+  // should not be reached
+  return q ;
+  */
+}
+
+// Lazy bindings
+//
+// With option lazy, the bindings of a solution are recorded in prolog and
+// returned as an ALTREP list. An element is translated to R when it is
+// accessed and then cached, so that helper structures that are never read in
+// R are never translated. Each record holds FreeVars-Value, with the query
+// variables that are still unbound, so that these keep their R names. ALTREP
+// lists are available since R 4.3, older versions translate immediately.
+#if defined(R_VERSION) && R_VERSION >= R_Version(4, 3, 0)
+#define ROLOG_ALTLIST
+
+struct RlLazyBindings
+{
+  std::vector<record_t> terms ;
+  CharacterVector names ;
+  List options ;
+  std::vector<bool> done ;
+
+  ~RlLazyBindings()
+  {
+    if(PL_is_initialised(NULL, NULL))
+      for(record_t r : terms)
+        PL_erase(r) ;
+  }
+} ;
+
+static R_altrep_class_t bindings_class ;
+
+static void bindings_finalize(SEXP p)
+{
+  delete (RlLazyBindings*) R_ExternalPtrAddr(p) ;
+  R_ClearExternalPtr(p) ;
+}
+
+static R_xlen_t bindings_length(SEXP x)
+{
+  return XLENGTH(R_altrep_data2(x)) ;
+}
+
+static SEXP bindings_elt(SEXP x, R_xlen_t i)
+{
+  RlLazyBindings* b = (RlLazyBindings*) R_ExternalPtrAddr(R_altrep_data1(x)) ;
+  SEXP values = R_altrep_data2(x) ;
+  if(b == NULL || b->done[i])
+    return VECTOR_ELT(values, i) ;
+
+  char msg[256] = "" ;
+  bool failed = false ;
+  fid_t f = PL_open_foreign_frame() ;
+  try
+  {
+    PlTerm_var pair ;
+    PlCheckFail(PL_recorded(b->terms[i], pair.C_)) ;
+    PlTerm unbound = pair[1] ;
+    SET_VECTOR_ELT(values, i, pl2r_transfer(pair[2], b->names, unbound, b->options)) ;
+    b->done[i] = true ;
+  }
+
+  catch(std::exception& ex)
+  {
+    snprintf(msg, sizeof(msg), "%s", ex.what()) ;
+    failed = true ;
+  }
+
+  PL_discard_foreign_frame(f) ;
+  if(failed)
+    Rf_error("cannot translate binding: %s", msg) ;
+
+  return VECTOR_ELT(values, i) ;
+}
+
+static void bindings_set_elt(SEXP x, R_xlen_t i, SEXP v)
+{
+  RlLazyBindings* b = (RlLazyBindings*) R_ExternalPtrAddr(R_altrep_data1(x)) ;
+  SET_VECTOR_ELT(R_altrep_data2(x), i, v) ;
+  if(b)
+    b->done[i] = true ;
+}
+
+static void* bindings_dataptr(SEXP x, Rboolean writeable)
+{
+  for(R_xlen_t i=0 ; i<bindings_length(x) ; i++)
+    bindings_elt(x, i) ;
+
+  return DATAPTR(R_altrep_data2(x)) ;
+}
+
+static Rboolean bindings_inspect(SEXP x, int pre, int deep, int pvec, 
+  void (*inspect_subtree)(SEXP, int, int, int))
+{
+  RlLazyBindings* b = (RlLazyBindings*) R_ExternalPtrAddr(R_altrep_data1(x)) ;
+  size_t n = b ? std::count(b->done.begin(), b->done.end(), true) : 0 ;
+  Rprintf("rolog bindings (%d of %d translated)\n", (int) n, (int) bindings_length(x)) ;
+  return TRUE ;
+}
+
+// Register the ALTREP class when the package is loaded
+//
+// [[Rcpp::init]]
+void bindings_init(DllInfo* dll)
+{
+  bindings_class = R_make_altlist_class("bindings", "rolog", dll) ;
+  R_set_altrep_Length_method(bindings_class, bindings_length) ;
+  R_set_altrep_Inspect_method(bindings_class, bindings_inspect) ;
+  R_set_altvec_Dataptr_method(bindings_class, bindings_dataptr) ;
+  R_set_altlist_Elt_method(bindings_class, bindings_elt) ;
+  R_set_altlist_Set_elt_method(bindings_class, bindings_set_elt) ;
+}
+
+static SEXP lazy_bindings(const std::vector<record_t>& terms, CharacterVector lnames, 
+  CharacterVector unbound, List options)
+{
+  RlLazyBindings* b = new RlLazyBindings() ;
+  b->terms = terms ;
+  b->names = unbound ;
+  b->options = options ;
+  b->done.assign(terms.size(), false) ;
+
+  SEXP p = PROTECT(R_MakeExternalPtr(b, R_NilValue, R_NilValue)) ;
+  R_RegisterCFinalizerEx(p, bindings_finalize, TRUE) ;
+  SEXP values = PROTECT(Rf_allocVector(VECSXP, terms.size())) ;
+  SEXP x = PROTECT(R_new_altrep(bindings_class, p, values)) ;
+  Rf_setAttrib(x, R_NamesSymbol, lnames) ;
+  UNPROTECT(3) ;
+  return x ;
+}
+
+#else
+
+void bindings_init(DllInfo* dll)
+{
+}
+
+#endif
+
+// Selected variable, see option select
+static bool selected(SEXP select, SEXP name)
+{
+  if(Rf_isNull(select))
+    return true ;
+
+  for(R_xlen_t j=0 ; j<XLENGTH(select) ; j++)
+    if(!strcmp(CHAR(STRING_ELT(select, j)), CHAR(name)))
+      return true ;
+
+  return false ;
+}
+
+// Bindings of the current solution
+//
+// Only the variables in select (or option select) are translated, default is
+// all. Variables that are still unbound are skipped without translation.
+List RlQuery::bindings(RObject select)
+{
+  RlSpanTimer span("bindings", "query") ;
+  if(Rf_isNull(select) && options.containsElementNamed("select"))
+    select = options["select"] ;
+
+  if(!Rf_isNull(select))
+    select = as<CharacterVector>(select) ;
+
+#ifdef ROLOG_ALTLIST
+  bool lazy = option_true(options, "lazy") ;
+#else
+  bool lazy = false ;
+#endif
+
+  // Query variables in consecutive term references
+  int nv = names.length() ;
+  term_t vs = nv ? PL_new_term_refs(nv) : 0 ;
+  std::vector<int> unbound_idx ;
+  {
+    PlTerm_tail tail(vars) ;
+    PlTerm_var v ;
+    for(int i=0 ; i<nv ; i++)
+    {
+      PlCheckFail(tail.next(v)) ;
+      PlCheckFail(PL_put_term(vs + i, v.C_)) ;
+      if(PL_is_variable(vs + i))
+        unbound_idx.push_back(i) ;
+    }
+  }
+
+  // Unbound variables that are not shared with an earlier one. The unbound
+  // variables are sorted in standard order, so that aliases are adjacent,
+  // instead of comparing each variable with all earlier ones.
+  std::sort(unbound_idx.begin(), unbound_idx.end(), [vs](int a, int b)
+  {
+    int c = PL_compare(vs + a, vs + b) ;
+    return c < 0 || (c == 0 && a < b) ;
+  }) ;
+
+  std::vector<bool> fresh(nv, false) ;
+  for(size_t k=0 ; k<unbound_idx.size() ; k++)
+    if(k == 0 || PL_compare(vs + unbound_idx[k-1], vs + unbound_idx[k]) != 0)
+      fresh[unbound_idx[k]] = true ;
+
+  // Unbound query variables for the lazy bindings
+  CharacterVector unbound ;
+  PlTerm_var unbound_vars ;
+  if(lazy)
+  {
+    PlTerm_tail utail(unbound_vars) ;
+    for(int i=0 ; i<nv ; i++)
+    {
+      if(PL_is_variable(vs + i))
+      {
+        PlCheckFail(utail.append(PlTerm(vs + i))) ;
+        unbound.push_back(names[i]) ;
+      }
+    }
+
+    PlCheckFail(utail.close()) ;
+  }
+
+  List l ;
+  std::vector<record_t> terms ;
+  CharacterVector lnames ;
+  for(int i=0 ; i<nv ; i++)
+  {
+    PlTerm v(vs + i) ;
+    if(!selected(select, names[i]))
+      continue ;
+
+    if(fresh[i])
+      continue ;
+
+    if(lazy)
+    {
+      PlTerm_var pair ;
+      PlCheckFail(pair.unify_term(PlCompound("-", PlTermv(unbound_vars, v)))) ;
+      terms.push_back(PL_record(pair.C_)) ;
+      lnames.push_back(names[i]) ;
+      continue ;
+    }
+
+    RObject r = pl2r_transfer(v, names, vars, options) ;
+    if(TYPEOF(r) == EXPRSXP && names[i] == as<Symbol>(as<ExpressionVector>(r)[0]).c_str())
+    continue ;
+
+    l.push_back(r, (const char*) names[i]) ;
+  }
+
+#ifdef ROLOG_ALTLIST
+  if(lazy)
+    return lazy_bindings(terms, lnames, unbound, options) ;
+#endif
+
+  return l ;
+}
+
+// Stack of open queries
+//
+// Queries can be nested: prolog may call R (r_eval), which may raise a query
+// again. Each r_eval starts a new level at query_base. A query opened with
+// query() lives on the current level and must be cleared before another one
+// can be opened there. Queries of once() and findall() are pushed on the stack
+// as well, so that r_eval finds the options of the innermost query. When
+// r_eval returns to prolog, queries left open on its level are closed.
+static std::vector<RlQuery*> query_stack ;
+static size_t query_base = 0 ;
+
+// Open query of the current level, or NULL
+static RlQuery* current_query()
+{
+  if(query_stack.size() > query_base)
+    return query_stack.back() ;
+
+  return NULL ;
+}
+
+// Options of the innermost query, for r_eval
+static const List* innermost_options()
+{
+  if(query_stack.empty())
+    return NULL ;
+
+  return &query_stack.back()->get_options() ;
+}
+
+// Query of once and findall, removed from the stack when the call is done
+class RlQueryScope
+{
+  RlQuery* q ;
+
+public:
+  RlQueryScope(RObject query, List options, Environment env)
+    : q(new RlQuery(query, options, env))
+  {
+    query_stack.push_back(q) ;
+  }
+
+  ~RlQueryScope()
+  {
+    query_stack.pop_back() ;
+    delete q ;
+  }
+
+  RlQuery* get()
+  {
+    return q ;
+  }
+} ;
+
+// New level for the queries raised by R within r_eval
+class RlQueryLevel
+{
+  size_t base ;
+
+public:
+  RlQueryLevel()
+    : base(query_base)
+  {
+    query_base = query_stack.size() ;
+  }
+
+  ~RlQueryLevel()
+  {
+    while(query_stack.size() > query_base)
+    {
+      delete query_stack.back() ;
+      query_stack.pop_back() ;
+    }
+
+    query_base = base ;
+  }
+} ;
+
+// Next solution as a list of bindings, or FALSE, with the attribute status if
+// a budget is exhausted. See RlQuery::bindings for select.
+static RObject query_next(RlQuery* q, RObject select=R_NilValue)
+{
+  if(!q->next_solution())
+  {
+    LogicalVector r = wrap(false) ;
+    if(!q->get_status().empty())
+      r.attr("status") = q->get_status() ;
+
+    return r ;
+  }
+
+  return q->bindings(select) ;
+}
+
+// Open a query for later use.
+// [[Rcpp::export(.query)]]
+RObject query_(RObject query, List options, Environment env)
+{
+  if(current_query())
+  {
+    warning("Cannot raise simultaneous queries. Please invoke clear()") ;
+    return wrap(false) ;
+  }
+
+  query_stack.push_back(new RlQuery(query, options, env)) ;
+  return wrap(true) ;
+}
+
+// Clear query (and invoke cleanup handlers, see PL_close_query)
+// [[Rcpp::export(.clear)]]
+RObject clear_()
+{
+  if(current_query())
+  {
+    delete query_stack.back() ;
+    query_stack.pop_back() ;
+  }
+
+  return wrap(true) ;
+}
+
+// Submit query, translate only the variables in select (NULL for all)
+// [[Rcpp::export(.submit)]]
+RObject submit_(RObject select)
+{
+  RlQuery* q = current_query() ;
+  if(q == NULL)
+  {
+    warning("submit: no open query.") ;
+    return wrap(false) ;
+  }
+
+  RObject r = query_next(q, select) ;
+  if(TYPEOF(r) == LGLSXP)
+    clear_() ;
+
+  return r ;
+}
+
+// Execute a query once and return conditions
+//
+// Examples:
+//
+// once(call("=", 1, 2)) -> FALSE
+// once(call("=", 1, 1)) -> empty list
+// once(call("member", 1, list(2, expression(X)))) -> list stating that X = 1
+// once(call("=", list(expression(X), expression(Y)), list(1, expression(Z))))
+//   -> list stating that X = 1 and Z = Y
+// once(call("member", 1, expression(X))) -> list stating that X = [1 | _]; 
+//   e.g., something like [|]`(1, expression(`_6330`)). This is cumbersome, any
+//   better ideas are welcome.
+//
+// [[Rcpp::export(.once)]]
+RObject once_(RObject query, List options, Environment env)
+{
+  PlFrame f ;
+  RlQueryScope q(query, options, env) ;
+  return query_next(q.get()) ;
+}
+
+// Same as once_ above, but return all solutions to a query.
+// [[Rcpp::export(.findall)]]
+List findall_(RObject query, List options, Environment env)
+{
+  PlFrame f ;
+  RlQueryScope q(query, options, env) ;
+  List results ;
+  while(true)
+  {
+    RObject l = query_next(q.get()) ;
+    if(TYPEOF(l) == LGLSXP)
+    {
+      // Partial results if a budget is exhausted
+      if(l.hasAttribute("status"))
+        results.attr("status") = l.attr("status") ;
+      break ;
+    }
+    
+    results.push_back(l) ;
+  }
+  
+  return results ;
+}
+
+// Consult one or more files. If something fails, the procedure stops, and
+// will not try to consult the remaining files.
+//
+// [[Rcpp::export(.consult)]]
+LogicalVector consult_(CharacterVector files)
+{
+  for(R_xlen_t i=0; i<files.size(); i++)
+  {
+    try 
+    {
+      PlCall("consult", PlTermv(PlTerm_string(files(i))));
+    }
+    
+    catch(PlException& ex)
+    { 
+      String err(ex.as_string(PlEncoding::Locale));
+      PL_clear_exception() ;
+      stop("failed to consult %s: %s", (char*) files(i), err.get_cstring()) ;
+    }
+  }
+
+  return true ;
+}
+
+// Save the clauses of dynamic predicates to a file. The file starts with the
+// list of predicate indicators, followed by the clauses M:(H :- B), all in
+// SWI-Prolog's binary fast term format (see fast_write/2). The module is
+// outside the clause, so that the body runs in M after loading.
+//
+// [[Rcpp::export(.save_db)]]
+LogicalVector save_db_(String fname, CharacterVector predicates)
+{
+  PlFrame f ;
+  PlTerm_var t ;
+  PlCheckFail(PL_chars_to_term(
+    "F-Ps-setup_call_cleanup(open(F, write, S, [type(binary)]),"
+    "  ( fast_write(S, rolog_db(Ps)),"
+    "    forall(( member(P, Ps), strip_module(P, M, N/A),"
+    "             functor(H, N, A), clause(M:H, B) ),"
+    "           fast_write(S, M:(H :- B))) ), close(S))", t.C_)) ;
+
+  PlTerm_tail tail(t[1][2]) ;
+  for(R_xlen_t i=0; i<predicates.size(); i++)
+  {
+    PlTerm_var pi ;
+    if(!PL_chars_to_term((char*) predicates(i), pi.C_))
+      stop("rolog_save_db: invalid predicate indicator %s", (char*) predicates(i)) ;
+    PlCheckFail(tail.append(pi)) ;
+  }
+
+  PlCheckFail(tail.close()) ;
+  PlCheckFail(t[1][1].unify_term(PlTerm_string(fname.get_cstring()))) ;
+  try
+  {
+    if(!PlCall("call", PlTermv(t[2])))
+      stop("failed to save %s", fname.get_cstring()) ;
+  }
+
+  catch(PlException& ex)
+  {
+    String err(ex.as_string(PlEncoding::Locale)) ;
+    PL_clear_exception() ;
+    stop("failed to save %s: %s", fname.get_cstring(), err.get_cstring()) ;
+  }
+
+  return true ;
+}
+
+// Load clauses saved by save_db_. Existing clauses of the saved predicates 
+// are removed before the new ones are added.
+//
+// [[Rcpp::export(.load_db)]]
+LogicalVector load_db_(String fname)
+{
+  PlFrame f ;
+  PlTerm_var t ;
+  PlCheckFail(PL_chars_to_term(
+    "F-setup_call_cleanup(open(F, read, S, [type(binary)]),"
+    "  ( fast_read(S, rolog_db(Ps)),"
+    "    forall(( member(P, Ps), strip_module(P, M, N/A), functor(H, N, A) ),"
+    "           ( dynamic(M:N/A), retractall(M:H) )),"
+    "    repeat,"
+    "    (   at_end_of_stream(S)"
+    "    ->  !"
+    "    ;   fast_read(S, C), assertz(C), fail"
+    "    ) ), close(S))", t.C_)) ;
+
+  PlCheckFail(t[1].unify_term(PlTerm_string(fname.get_cstring()))) ;
+  try
+  {
+    if(!PlCall("call", PlTermv(t[2])))
+      stop("failed to load %s", fname.get_cstring()) ;
+  }
+
+  catch(PlException& ex)
+  {
+    String err(ex.as_string(PlEncoding::Locale)) ;
+    PL_clear_exception() ;
+    stop("failed to load %s: %s", fname.get_cstring(), err.get_cstring()) ;
+  }
+
+  return true ;
+}
+
+// Materialized views
+//
+// A view is a tabled predicate rolog_view_<id>/N, with the variables of the
+// query as arguments, and declared incremental, so that the table is updated
+// when the clauses of the incremental dynamic predicates change. The answers
+// of the last refresh are kept in a trie, which is stored in a global
+// variable of the same name, such that only the difference is translated to
+// R. A listener on the dynamic predicates raises the flag of the same name
+// whenever their clauses change, so that a refresh without changes does not
+// visit the table at all.
+static int view_id = 0 ;
+
+// [[Rcpp::export(.materialize)]]
+List materialize_(RObject query, CharacterVector dynamic, List aoptions)
+{
+  List options(aoptions) ;
+  options("atomize") = false ;
+
+  PlFrame f ;
+  CharacterVector names ;
+  PlTerm_var vars ;
+  PlTerm goal = r2pl(query, names, vars, options) ;
+
+  std::string name = "rolog_view_" + std::to_string(++view_id) ;
+  PlTerm_var head ;
+  if(names.length() == 0)
+    PlCheckFail(head.unify_atom(name.c_str())) ;
+  else
+  {
+    PlTermv args(names.length()) ;
+    PlTerm_tail tail(vars) ;
+    for(R_xlen_t i=0 ; i<names.length() ; i++)
+      PlCheckFail(tail.next(args[i])) ;
+    PlCheckFail(head.unify_term(PlCompound(name.c_str(), args))) ;
+  }
+
+  // The clause is loaded from a string, like from a file with a table
+  // directive
+  PlTerm_var t ;
+  PlCheckFail(PL_chars_to_term(
+    "m(N, H, G, Ds)-"
+    "  ( forall(member(D, Ds), dynamic(D, [incremental(true)])),"
+    "    functor(H, _, A),"
+    "    with_output_to(string(T),"
+    "      ( format(':- table ~q as incremental.~n', [N/A]),"
+    "        portray_clause((H :- G)) )),"
+    "    setup_call_cleanup(open_string(T, S),"
+    "      load_files(N, [stream(S), silent(true)]), close(S)),"
+    "    trie_new(Trie), nb_setval(N, Trie), flag(N, _, 1),"
+    "    forall(member(D, Ds), prolog_listen(D, [_, _]>>flag(N, _, 1))) )", t.C_)) ;
+
+  PlCheckFail(t[1][1].unify_atom(name.c_str())) ;
+  PlCheckFail(t[1][2].unify_term(head)) ;
+  PlCheckFail(t[1][3].unify_term(goal)) ;
+  PlTerm_tail tail(t[1][4]) ;
+  for(R_xlen_t i=0; i<dynamic.size(); i++)
+  {
+    PlTerm_var pi ;
+    if(!PL_chars_to_term((char*) dynamic(i), pi.C_))
+      stop("materialize: invalid predicate indicator %s", (char*) dynamic(i)) ;
+    PlCheckFail(tail.append(pi)) ;
+  }
+
+  PlCheckFail(tail.close()) ;
+  try
+  {
+    if(!PlCall("call", PlTermv(t[2])))
+      stop("materialize: could not create view") ;
+  }
+
+  catch(PlException& ex)
+  {
+    String err(ex.as_string(PlEncoding::Locale)) ;
+    PL_clear_exception() ;
+    stop("materialize: %s", err.get_cstring()) ;
+  }
+
+  List handle = List::create(Named("name") = name, Named("variables") = names) ;
+  handle.attr("class") = "rolog_view" ;
+  return handle ;
+}
+
+// Rows of a view, translated to lists with the bindings, see findall. The
+// variables in the rows are fresh.
+List view_rows(PlTerm rows, CharacterVector& keys, List& options)
+{
+  CharacterVector names ;
+  PlTerm_var vars ;
+  List l ;
+  PlTerm_tail tail(rows) ;
+  PlTerm_var row ;
+  while(tail.next(row))
+  {
+    List bindings ;
+    for(R_xlen_t i=0 ; i<keys.length() ; i++)
+      bindings.push_back(pl2r(row[i + 1], names, vars, options), (const char*) keys(i)) ;
+    l.push_back(bindings) ;
+  }
+
+  return l ;
+}
+
+// Answers added and removed since the last refresh. The answers of the table
+// are looked up in the trie of the last refresh and inserted into a new one;
+// the answers of the old trie that are missing in the new one are removed.
+//
+// [[Rcpp::export(.refresh)]]
+List refresh_(String name, CharacterVector names, List aoptions)
+{
+  List options(aoptions) ;
+  PlFrame f ;
+  PlTerm_var t ;
+  PlCheckFail(PL_chars_to_term(
+    "m(N, A, Added, Removed)-"
+    "  ( functor(H, N, A),"
+    "    nb_getval(N, Old),"
+    "    (   flag(N, 1, 0)"
+    "    ->  trie_new(New),"
+    "        findall(H, ( call(H), trie_insert(New, H),"
+    "          \\+ trie_lookup(Old, H, _) ), Added),"
+    "        findall(H, ( trie_gen(Old, H),"
+    "          \\+ trie_lookup(New, H, _) ), Removed),"
+    "        nb_setval(N, New),"
+    "        trie_destroy(Old)"
+    "    ;   Added = [], Removed = []"
+    "    ) )", t.C_)) ;
+
+  PlCheckFail(t[1][1].unify_atom(name.get_cstring())) ;
+  PlCheckFail(t[1][2].unify_integer((int) names.length())) ;
+  try
+  {
+    if(!PlCall("call", PlTermv(t[2])))
+      stop("refresh: unknown view %s", name.get_cstring()) ;
+  }
+
+  catch(PlException& ex)
+  {
+    String err(ex.as_string(PlEncoding::Locale)) ;
+    PL_clear_exception() ;
+    stop("refresh: %s", err.get_cstring()) ;
+  }
+
+  return List::create(
+    Named("added") = view_rows(t[1][3], names, options),
+    Named("removed") = view_rows(t[1][4], names, options)) ;
+}
+
+// Background queries
+//
+// The query runs in a separate prolog thread. Its solutions are sent to a
+// message queue as instances of a template v(X, Y, ...) with the variables of
+// the query, and only translated to R in collect, that is, in R's thread. The
+// handles of the thread and the queue are kept in a record.
+struct RlAsync
+{
+  record_t handles ;
+  CharacterVector names ;
+  R_xlen_t collected ;
+  std::string status ;
+} ;
+
+static std::map<int, RlAsync> async_queries ;
+
+// Maximum number of solutions that wait in the queue. The query blocks until
+// collect() makes room, so that a large search does not fill the memory.
+static const int async_buffer = 10000 ;
+static int async_id = 0 ;
+
+// [[Rcpp::export(.query_async)]]
+List query_async_(RObject query, List aoptions)
+{
+  List options(aoptions) ;
+  options("atomize") = false ;
+
+  PlFrame f ;
+  RlAsync a ;
+  PlTerm_var vars ;
+  PlTerm goal = r2pl(query, a.names, vars, options) ;
+
+  PlTerm_var templ ;
+  if(a.names.length() == 0)
+    PlCheckFail(templ.unify_atom("v")) ;
+  else
+  {
+    PlTermv args(a.names.length()) ;
+    PlTerm_tail tail(vars) ;
+    for(R_xlen_t i=0 ; i<a.names.length() ; i++)
+      PlCheckFail(tail.next(args[i])) ;
+    PlCheckFail(templ.unify_term(PlCompound("v", args))) ;
+  }
+
+  PlTerm_var t ;
+  PlCheckFail(PL_chars_to_term(
+    "m(G, T, Q, Id, N)-"
+    "  ( message_queue_create(Q, [max_size(N)]),"
+    "    thread_create("
+    "      catch(( forall(G, thread_send_message(Q, solution(T))),"
+    "              thread_send_message(Q, done) ),"
+    "            E, thread_send_message(Q, error(E))), Id, []) )", t.C_)) ;
+
+  PlCheckFail(t[1][1].unify_term(goal)) ;
+  PlCheckFail(t[1][2].unify_term(templ)) ;
+  PlCheckFail(t[1][5].unify_integer(async_buffer)) ;
+  try
+  {
+    if(!PlCall("call", PlTermv(t[2])))
+      stop("query_async: could not start query") ;
+  }
+
+  catch(PlException& ex)
+  {
+    String err(ex.as_string(PlEncoding::Locale)) ;
+    PL_clear_exception() ;
+    stop("query_async: %s", err.get_cstring()) ;
+  }
+
+  a.handles = PL_record(PlCompound("m", PlTermv(t[1][3], t[1][4])).C_) ;
+  a.collected = 0 ;
+  a.status = "running" ;
+
+  int id = ++async_id ;
+  async_queries[id] = a ;
+  return List::create(Named("id") = id, Named("variables") = a.names) ;
+}
+
+static RlAsync& async_query(int id)
+{
+  std::map<int, RlAsync>::iterator a = async_queries.find(id) ;
+  if(a == async_queries.end())
+    stop("unknown background query %d", id) ;
+  return a->second ;
+}
+
+// Status and number of solutions, without translating them
+//
+// [[Rcpp::export(.poll)]]
+List poll_(int id)
+{
+  RlAsync& a = async_query(id) ;
+  std::string status = a.status ;
+  int64_t buffered = 0 ;
+  if(a.status == "running")
+  {
+    PlFrame f ;
+    PlTerm_var h ;
+    PlTerm_var n ;
+    PlTerm_var s ;
+    PlCheckFail(PL_recorded(a.handles, h.C_)) ;
+    if(PlCall("message_queue_property", PlTermv(h[1], PlCompound("size", PlTermv(n)))))
+      PL_get_int64(n.C_, &buffered) ;
+
+    // The thread has finished, but the solutions have not been collected yet
+    if(PlCall("thread_property", PlTermv(h[2], PlCompound("status", PlTermv(s))))
+       && !(s.is_atom() && s.as_string() == "running"))
+      status = "done" ;
+  }
+
+  return List::create(Named("status") = status,
+    Named("buffered") = (double) buffered, Named("collected") = (double) a.collected) ;
+}
+
+// Translate the buffered solutions to R. With wait = TRUE, this waits until
+// the query is complete, in slices of 0.1 s with checks for user interrupts.
+//
+// [[Rcpp::export(.collect)]]
+List collect_(int id, bool wait, List aoptions)
+{
+  RlAsync& a = async_query(id) ;
+  List options(aoptions) ;
+  List results ;
+  if(a.status != "running")
+    return results ;
+
+  PlFrame f ;
+  PlTerm_var h ;
+  PlCheckFail(PL_recorded(a.handles, h.C_)) ;
+  while(a.status == "running")
+  {
+    PlTerm_var msg ;
+    PlTerm_var opts ;
+    PlTerm_tail tail(opts) ;
+    PlCheckFail(tail.append(PlCompound("timeout", PlTermv(PlTerm_float(wait ? 0.1 : 0))))) ;
+    PlCheckFail(tail.close()) ;
+    if(!PlCall("thread_get_message", PlTermv(h[1], msg, opts)))
+    {
+      if(!wait)
+        break ;
+
+      if(user_interrupt())
+        stop("collect: interrupted, the query is still running (see cancel)") ;
+
+      continue ;
+    }
+
+    if(msg.is_atom())
+    {
+      a.status = "done" ;
+      break ;
+    }
+
+    if(msg.name().as_string() == "error")
+    {
+      warning("query_async: %s", msg[1].as_string(PlEncoding::Locale).c_str()) ;
+      a.status = "error" ;
+      break ;
+    }
+
+    // solution(v(X, Y, ...))
+    CharacterVector names ;
+    PlTerm_var vars ;
+    PlTerm row = msg[1] ;
+    List bindings ;
+    for(R_xlen_t i=0 ; i<a.names.length() ; i++)
+      bindings.push_back(pl2r(row[i + 1], names, vars, options), (const char*) a.names(i)) ;
+    results.push_back(bindings) ;
+    a.collected++ ;
+  }
+
+  // Clean up when the query is complete
+  if(a.status != "running")
+  {
+    PlCall("thread_join", PlTermv(PlTerm(h[2]), PlTerm_var())) ;
+    PlCall("message_queue_destroy", PlTermv(PlTerm(h[1]))) ;
+    PL_erase(a.handles) ;
+  }
+
+  return results ;
+}
+
+// Stop a background query with abort, join its thread and destroy the
+// message queue. This is also called by the finalizer of the handle, so
+// that queries that are never collected do not leak. Returns FALSE if the
+// query was complete or unknown.
+//
+// [[Rcpp::export(.cancel)]]
+LogicalVector cancel_(int id)
+{
+  std::map<int, RlAsync>::iterator a = async_queries.find(id) ;
+  if(a == async_queries.end())
+    return false ;
+
+  bool running = a->second.status == "running" ;
+  if(running)
+  {
+    PlFrame f ;
+    PlTerm_var h ;
+    PlCheckFail(PL_recorded(a->second.handles, h.C_)) ;
+    PL_erase(a->second.handles) ;
+    async_queries.erase(a) ;
+    try
+    {
+      // The thread may have finished in the meantime
+      PlCall("catch", PlTermv(PlCompound("thread_signal", PlTermv(h[2], PlTerm_atom("abort"))),
+        PlTerm_var(), PlTerm_atom("true"))) ;
+      PlCall("thread_join", PlTermv(h[2], PlTerm_var())) ;
+      PlCall("message_queue_destroy", PlTermv(h[1])) ;
+    }
+
+    catch(PlException& ex)
+    {
+      String err(ex.as_string(PlEncoding::Locale)) ;
+      PL_clear_exception() ;
+      stop("cancel: %s", err.get_cstring()) ;
+    }
+
+    return true ;
+  }
+
+  async_queries.erase(a) ;
+  return false ;
+}
+
+// Register a codec for an R class, see rolog_codec
+//
+// [[Rcpp::export(.codec)]]
+LogicalVector codec_(String rclass, String functor, int arity, Function encode, Function decode)
+{
+  R_PreserveObject(encode) ;
+  R_PreserveObject(decode) ;
+  RlCodec c = { functor.get_cstring(), (size_t) arity, NULL, NULL, NULL, NULL, encode, decode } ;
+  rolog_codecs().add(rclass.get_cstring(), c) ;
+  return true ;
+}
+
+// Register a codec from C/C++, see R_GetCCallable("rolog", "rolog_codec")
+static int rolog_codec_c(const char* rclass, const char* functor, int arity,
+  int (*encode)(SEXP r, term_t pl), SEXP (*decode)(term_t pl))
+{
+  RlCodec c = { functor, (size_t) arity, NULL, NULL, encode, decode, NULL, NULL } ;
+  rolog_codecs().add(rclass, c) ;
+  return TRUE ;
+}
+
+// [[Rcpp::init]]
+void codec_init(DllInfo* dll)
+{
+  R_RegisterCCallable("rolog", "rolog_codec", (DL_FUNC) rolog_codec_c) ;
+}
+
+// Native term writer for portray
+//
+// The writer produces the same text as term_string/3 with the options
+// quoted(false) and spacing(next_argument), applied to the prolog translation
+// of an R object. It works on the R object directly, so that no prolog terms
+// are created and no query is needed. The translation follows r2pl with 
+// atomize = true. Only SWI-Prolog's default operators are known.
+
+// Lightweight term for the writer
+struct RlTerm
+{
+  enum { ATOM, NUMBER, STRING, LIST, DICT, COMPOUND } ;
+
+  int type ;
+  std::string name ;
+  std::vector<RlTerm> args ;
+
+  RlTerm(int atype, const std::string& aname)
+    : type(atype), name(aname), args()
+  {}
+} ;
+
+// Operators with priority and the maximum priority of their arguments
+struct RlOp
+{
+  int pri ;
+  int left ;
+  int right ;
+} ;
+
+static const std::map<std::string, RlOp>& infix_ops()
+{
+  static const std::map<std::string, RlOp> ops = {
+    { ":-", { 1200, 1199, 1199 } }, { "-->", { 1200, 1199, 1199 } },
+    { "=>", { 1200, 1199, 1199 } },
+    { ";", { 1100, 1099, 1100 } }, { "|", { 1100, 1099, 1100 } },
+    { "->", { 1050, 1049, 1050 } }, { "*->", { 1050, 1049, 1050 } },
+    { ",", { 1000, 999, 1000 } },
+    { ":=", { 990, 989, 989 } },
+    { "=", { 700, 699, 699 } }, { "\\=", { 700, 699, 699 } },
+    { "==", { 700, 699, 699 } }, { "\\==", { 700, 699, 699 } },
+    { "@<", { 700, 699, 699 } }, { "@>", { 700, 699, 699 } },
+    { "@=<", { 700, 699, 699 } }, { "@>=", { 700, 699, 699 } },
+    { "=..", { 700, 699, 699 } }, { "is", { 700, 699, 699 } },
+    { "=:=", { 700, 699, 699 } }, { "=\\=", { 700, 699, 699 } },
+    { "<", { 700, 699, 699 } }, { ">", { 700, 699, 699 } },
+    { "=<", { 700, 699, 699 } }, { ">=", { 700, 699, 699 } },
+    { ">:<", { 700, 699, 699 } }, { ":<", { 700, 699, 699 } },
+    { "as", { 700, 699, 699 } },
+    { ":", { 200, 199, 200 } },
+    { "+", { 500, 500, 499 } }, { "-", { 500, 500, 499 } },
+    { "/\\", { 500, 500, 499 } }, { "\\/", { 500, 500, 499 } },
+    { "xor", { 500, 500, 499 } },
+    { "*", { 400, 400, 399 } }, { "/", { 400, 400, 399 } },
+    { "//", { 400, 400, 399 } }, { "rdiv", { 400, 400, 399 } },
+    { "<<", { 400, 400, 399 } }, { ">>", { 400, 400, 399 } },
+    { "mod", { 400, 400, 399 } }, { "rem", { 400, 400, 399 } },
+    { "div", { 400, 400, 399 } }, { "divmod", { 400, 400, 399 } },
+    { "**", { 200, 199, 199 } }, { "^", { 200, 199, 200 } }
+  } ;
+
+  return ops ;
+}
+
+// Prefix operators, left is unused
+static const std::map<std::string, RlOp>& prefix_ops()
+{
+  static const std::map<std::string, RlOp> ops = {
+    { ":-", { 1200, 0, 1199 } }, { "?-", { 1200, 0, 1199 } },
+    { "dynamic", { 1150, 0, 1149 } }, { "discontiguous", { 1150, 0, 1149 } },
+    { "initialization", { 1150, 0, 1149 } }, { "meta_predicate", { 1150, 0, 1149 } },
+    { "module_transparent", { 1150, 0, 1149 } }, { "multifile", { 1150, 0, 1149 } },
+    { "public", { 1150, 0, 1149 } }, { "thread_local", { 1150, 0, 1149 } },
+    { "table", { 1150, 0, 1149 } },
+    { "\\+", { 900, 0, 900 } },
+    { "?", { 500, 0, 499 } },
+    { "-", { 200, 0, 200 } }, { "+", { 200, 0, 200 } }, { "\\", { 200, 0, 200 } },
+    { "$", { 1, 0, 0 } }
+  } ;
+
+  return ops ;
+}
+
+// Format a float like write/1: the shortest representation that is read back
+// to the same number, with a dot or an exponent, e.g. 1.0, 0.1, 1.0e20.
+std::string portray_float(double x)
+{
+  if(std::isnan(x))
+    return "nan" ;
+
+  if(std::isinf(x))
+    return x > 0 ? "inf" : "-inf" ;
+
+  char buf[40] ;
+  for(int prec=0 ; prec<17 ; prec++)
+  {
+    snprintf(buf, sizeof(buf), "%.*e", prec, x) ;
+    if(strtod(buf, NULL) == x)
+      break ;
+  }
+
+  // Split -d.ddde+XX into sign, digits and exponent
+  std::string s(buf) ;
+  std::string out ;
+  if(s[0] == '-')
+  {
+    out = "-" ;
+    s.erase(0, 1) ;
+  }
+
+  size_t e = s.find('e') ;
+  int decpt = atoi(s.c_str() + e + 1) + 1 ;
+  std::string digits ;
+  for(size_t i=0 ; i<e ; i++)
+    if(isdigit(s[i]))
+      digits += s[i] ;
+  while(digits.size() > 1 && digits.back() == '0')
+    digits.pop_back() ;
+  int ndigits = (int) digits.size() ;
+
+  // Exponential notation for very small and very large numbers
+  if(decpt <= -4 || (decpt > 15 && ndigits <= decpt))
+  {
+    out += digits[0] ;
+    out += '.' ;
+    out += ndigits > 1 ? digits.substr(1) : "0" ;
+    return out + "e" + std::to_string(decpt - 1) ;
+  }
+
+  // Dot before the digits, e.g. 0.001
+  if(decpt <= 0)
+    return out + "0." + std::string(-decpt, '0') + digits ;
+
+  // Dot inside, e.g., 3.14
+  if(ndigits > decpt)
+    return out + digits.substr(0, decpt) + "." + digits.substr(decpt) ;
+
+  // Dot after, e.g., 100.0
+  return out + digits + std::string(decpt - ndigits, '0') + ".0" ;
+}
+
+// Forward declaration, needed below
+RlTerm portray_term(SEXP r, List& options) ;
+
+RlTerm portray_na()
+{
+  return RlTerm(RlTerm::ATOM, "na") ;
+}
+
+RlTerm portray_null()
+{
+  return RlTerm(RlTerm::ATOM, "[]") ;
+}
+
+// Vectors and matrices of reals, integers, booleans and strings, see r2pl_real
+// and the like
+RlTerm portray_element(SEXP r, R_xlen_t i)
+{
+  switch(TYPEOF(r))
+  {
+    case REALSXP:
+      if(ISNA(REAL(r)[i]))
+        return portray_na() ;
+      return RlTerm(RlTerm::NUMBER, portray_float(REAL(r)[i])) ;
+
+    case INTSXP:
+      if(INTEGER(r)[i] == NA_INTEGER)
+        return portray_na() ;
+      return RlTerm(RlTerm::NUMBER, std::to_string(INTEGER(r)[i])) ;
+
+    case LGLSXP:
+      if(LOGICAL(r)[i] == NA_LOGICAL)
+        return portray_na() ;
+      return RlTerm(RlTerm::ATOM, LOGICAL(r)[i] ? "true" : "false") ;
+
+    case STRSXP:
+      if(STRING_ELT(r, i) == NA_STRING)
+        return portray_na() ;
+      return RlTerm(RlTerm::STRING, Rf_translateCharUTF8(STRING_ELT(r, i))) ;
+  }
+
+  return portray_na() ;
+}
+
+RlTerm portray_vector(SEXP r, List& options)
+{
+  const char* vec = "realvec" ;
+  const char* mat = "realmat" ;
+  if(TYPEOF(r) == INTSXP)
+  {
+    vec = "intvec" ;
+    mat = "intmat" ;
+  }
+
+  if(TYPEOF(r) == LGLSXP)
+  {
+    vec = "boolvec" ;
+    mat = "boolmat" ;
+  }
+
+  if(TYPEOF(r) == STRSXP)
+  {
+    vec = "charvec" ;
+    mat = "charmat" ;
+  }
+
+  if(Rf_isMatrix(r))
+  {
+    int nrow = Rf_nrows(r) ;
+    int ncol = Rf_ncols(r) ;
+    RlTerm m(RlTerm::COMPOUND, as<std::string>(options(mat))) ;
+    for(int i=0 ; i<nrow ; i++)
+    {
+      RlTerm row(RlTerm::COMPOUND, as<std::string>(options(vec))) ;
+      for(int j=0 ; j<ncol ; j++)
+        row.args.push_back(portray_element(r, i + (R_xlen_t) j * nrow)) ;
+      m.args.push_back(row) ;
+    }
+
+    return m ;
+  }
+
+  R_xlen_t len = XLENGTH(r) ;
+  if(len == 0)
+    return portray_null() ;
+
+  if(as<LogicalVector>(options("scalar"))(0) && len == 1)
+    return portray_element(r, 0) ;
+
+  RlTerm v(RlTerm::COMPOUND, as<std::string>(options(vec))) ;
+  for(R_xlen_t i=0 ; i<len ; i++)
+    v.args.push_back(portray_element(r, i)) ;
+  return v ;
+}
+
+// Variables are shown with their R names, see r2pl_var
+RlTerm portray_atom(SEXP r, List& options)
+{
+  const char* name = CHAR(PRINTNAME(r)) ;
+  if(name[0] == '.' && option_true(options, "simplified"))
+    return RlTerm(RlTerm::ATOM, name[1] ? name + 1 : "_") ;
+
+  return RlTerm(RlTerm::ATOM, name) ;
+}
+
+// Named elements, a=1 in calls and a-1 in lists
+RlTerm portray_named(const char* op, SEXP names, R_xlen_t i, RlTerm arg)
+{
+  if(names == R_NilValue || !strcmp(CHAR(STRING_ELT(names, i)), ""))
+    return arg ;
+
+  RlTerm pair(RlTerm::COMPOUND, op) ;
+  pair.args.push_back(RlTerm(RlTerm::ATOM, CHAR(STRING_ELT(names, i)))) ;
+  pair.args.push_back(arg) ;
+  return pair ;
+}
+
+// See r2pl_dict, with the keys in the order of the R list
+RlTerm portray_dict(SEXP r, SEXP n, List& options)
+{
+  RlTerm d(RlTerm::DICT, "dict") ;
+  for(R_xlen_t i=0 ; i<XLENGTH(r) ; i++)
+    d.args.push_back(portray_named(":", n, i, portray_term(VECTOR_ELT(r, i), options))) ;
+  return d ;
+}
+
+// See r2pl_list
+RlTerm portray_list(SEXP r, List& options)
+{
+  RlTerm l(RlTerm::LIST, "[]") ;
+  SEXP n = Rf_getAttrib(r, R_NamesSymbol) ;
+  if(option_true(options, "dict") && n != R_NilValue && r2pl_dict_names(n))
+  {
+    if(!Rf_inherits(r, "data.frame"))
+      return portray_dict(r, n, options) ;
+
+    R_xlen_t nrow = Rf_xlength(Rf_getAttrib(r, R_RowNamesSymbol)) ;
+    for(R_xlen_t i=0 ; i<nrow ; i++)
+    {
+      List row(XLENGTH(r)) ;
+      for(R_xlen_t j=0 ; j<XLENGTH(r) ; j++)
+        row(j) = r2pl_cell(VECTOR_ELT(r, j), i) ;
+      l.args.push_back(portray_dict(row, n, options)) ;
+    }
+
+    return l ;
+  }
+
+  for(R_xlen_t i=0 ; i<XLENGTH(r) ; i++)
+    l.args.push_back(portray_named("-", n, i, portray_term(VECTOR_ELT(r, i), options))) ;
+  return l ;
+}
+
+// See r2pl_compound and r2pl_simplified
+RlTerm portray_compound(SEXP r, List& options)
+{
+  List args = as<List>(CDR(r)) ;
+  if(TYPEOF(CAR(r)) == SYMSXP && option_true(options, "simplified"))
+  {
+    const char* head = CHAR(PRINTNAME(CAR(r))) ;
+    if(!strcmp(head, "(") && CDR(r) != R_NilValue)
+    {
+      SEXP arg = CADR(r) ;
+      if(TYPEOF(arg) == SYMSXP)
+        return portray_term(Rcpp_eval(arg, Environment::global_env()), options) ;
+      return portray_term(arg, options) ;
+    }
+
+    if(!strcmp(head, "[") && CDR(r) != R_NilValue && TYPEOF(CADR(r)) == STRSXP
+       && XLENGTH(CADR(r)) == 1 && !strcmp(CHAR(STRING_ELT(CADR(r), 0)), ""))
+      return portray_list(as<List>(CDDR(r)), options) ;
+
+    if(!strcmp(head, "list"))
+      return portray_list(args, options) ;
+  }
+
+  RlTerm c(RlTerm::COMPOUND, rename_functor(as<Symbol>(CAR(r)).c_str(), options)) ;
+  SEXP n = Rf_getAttrib(args, R_NamesSymbol) ;
+  for(R_xlen_t i=0 ; i<args.size() ; i++)
+    c.args.push_back(portray_named("=", n, i, portray_term(args(i), options))) ;
+  return c ;
+}
+
+// See r2pl_function and r2pl_primitive
+RlTerm portray_function(SEXP r, List& options)
+{
+  RlTerm head(RlTerm::COMPOUND, "$function") ;
+  RlTerm neck(RlTerm::COMPOUND, ":-") ;
+  if(TYPEOF(r) == CLOSXP)
+  {
+#if defined(R_VERSION) && R_VERSION >= R_Version(4, 5, 0)
+    SEXP body = R_ClosureBody(r) ;
+    SEXP formals = R_ClosureFormals(r) ;
+#else
+    SEXP body = BODY(r) ;
+    SEXP formals = FORMALS(r) ;
+#endif
+    for(SEXP f=formals ; f != R_NilValue ; f=CDR(f))
+      head.args.push_back(RlTerm(RlTerm::ATOM, CHAR(PRINTNAME(TAG(f))))) ;
+    neck.args.push_back(head) ;
+    neck.args.push_back(portray_term(body, options)) ;
+    return neck ;
+  }
+
+  std::string name ;
+  CharacterVector formals ;
+  if(!primitive_signature(r, name, formals))
+    return portray_na() ;
+
+  RlTerm body(RlTerm::COMPOUND, rename_functor(name.c_str(), options)) ;
+  for(R_xlen_t i=0 ; i<formals.size() ; i++)
+  {
+    head.args.push_back(RlTerm(RlTerm::ATOM, as<std::string>(formals(i)))) ;
+    body.args.push_back(RlTerm(RlTerm::ATOM, as<std::string>(formals(i)))) ;
+  }
+
+  neck.args.push_back(head) ;
+  neck.args.push_back(body) ;
+  return neck ;
+}
+
+// See the codecs, e.g., '$r'(factor, %(1, 2, 1), $$("a", "b")). Codecs from
+// C/C++ are not known to the writer, the object is shown without its class.
+RlTerm portray_codec(SEXP r, const RlCodec& c, List& options)
+{
+  if(c.r_encode)
+  {
+    Function f(c.r_encode) ;
+    RObject e = f(r) ;
+    return portray_term(e, options) ;
+  }
+
+  RlTerm t(RlTerm::COMPOUND, c.functor) ;
+  if(c.functor == "factor")
+  {
+    t.args.push_back(portray_vector(r, options)) ;
+    t.args.push_back(portray_vector(Rf_getAttrib(r, R_LevelsSymbol), options)) ;
+    return t ;
+  }
+
+  if(c.functor == "Date")
+  {
+    RObject x = Rf_coerceVector(r, REALSXP) ;
+    t.args.push_back(portray_vector(x, options)) ;
+    return t ;
+  }
+
+  if(c.functor == "POSIXct")
+  {
+    RObject x = Rf_coerceVector(r, REALSXP) ;
+    SEXP tz = Rf_getAttrib(r, Rf_install("tzone")) ;
+    t.args.push_back(portray_vector(x, options)) ;
+    t.args.push_back(RlTerm(RlTerm::STRING,
+      TYPEOF(tz) == STRSXP && XLENGTH(tz) ? Rf_translateCharUTF8(STRING_ELT(tz, 0)) : "")) ;
+    return t ;
+  }
+
+  // data.frame, see r2pl_dataframe
+  SEXP n = Rf_getAttrib(r, R_NamesSymbol) ;
+  if(option_true(options, "dict") && n != R_NilValue && r2pl_dict_names(n))
+    return portray_list(r, options) ;
+
+  RlTerm cols(RlTerm::LIST, "[]") ;
+  for(R_xlen_t i=0 ; i<XLENGTH(r) ; i++)
+    cols.args.push_back(portray_term(VECTOR_ELT(r, i), options)) ;
+
+  t.args.push_back(n == R_NilValue ? portray_null() : portray_vector(n, options)) ;
+  t.args.push_back(cols) ;
+  return t ;
+}
+
+// Tagged compound of the codec, see codec_wrap
+RlTerm portray_tagged(SEXP r, const RlCodec& c, List& options)
+{
+  RlTerm t = portray_codec(r, c, options) ;
+  if(t.type != RlTerm::COMPOUND || t.name != c.functor || t.args.size() != c.arity)
+    return t ;
+
+  RlTerm tagged(RlTerm::COMPOUND, "$r") ;
+  tagged.args.push_back(RlTerm(RlTerm::ATOM, c.functor)) ;
+  tagged.args.insert(tagged.args.end(), t.args.begin(), t.args.end()) ;
+  return tagged ;
+}
+
+RlTerm portray_term(SEXP r, List& options)
+{
+  // Lazy list, shown as a variable, see r2pl_stream
+  if(OBJECT(r) && Rf_inherits(r, "rolog_stream"))
+    return RlTerm(RlTerm::ATOM, "_") ;
+
+  if(OBJECT(r) && option_true(options, "codecs"))
+  {
+    const RlCodec* c = codec_class(r) ;
+    if(c && (c->encode || c->r_encode))
+      return portray_tagged(r, *c, options) ;
+  }
+
+  switch(TYPEOF(r))
+  {
+    case LANGSXP: return portray_compound(r, options) ;
+    case REALSXP:
+    case INTSXP:
+    case LGLSXP:
+    case STRSXP: return portray_vector(r, options) ;
+    case EXPRSXP: return RlTerm(RlTerm::ATOM, as<Symbol>(VECTOR_ELT(r, 0)).c_str()) ;
+    case SYMSXP: return portray_atom(r, options) ;
+    case VECSXP: return portray_list(r, options) ;
+    case NILSXP: return portray_null() ;
+    case CLOSXP:
+    case BUILTINSXP:
+    case SPECIALSXP: return portray_function(r, options) ;
+  }
+
+  return portray_na() ;
+}
+
+// Write a term with operators, similar to pl-write.c
+class RlWriter
+{
+  std::string out ;
+
+  static bool alnum(char c)
+  {
+    return isalnum((unsigned char) c) || c == '_' || (c & 0x80) ;
+  }
+
+  static bool symbol(char c)
+  {
+    return c && strchr("#$&*+-./:<=>?@^~\\", c) ;
+  }
+
+  // Insert a space if the token would otherwise be glued to the previous one
+  void token(const std::string& t)
+  {
+    if(t.empty())
+      return ;
+
+    if(!out.empty())
+    {
+      char a = out.back() ;
+      char b = t[0] ;
+      if((alnum(a) && alnum(b)) || (symbol(a) && symbol(b)))
+        out += ' ' ;
+    }
+
+    out += t ;
+  }
+
+  void args(const std::vector<RlTerm>& a)
+  {
+    for(size_t i=0 ; i<a.size() ; i++)
+    {
+      if(i)
+        out += ", " ;
+      write(a[i], 999, true) ;
+    }
+  }
+
+  static bool is_op(const std::string& name)
+  {
+    return infix_ops().count(name) || prefix_ops().count(name) ;
+  }
+
+public:
+  void write(const RlTerm& t, int prec=1200, bool arg=false)
+  {
+    if(t.type == RlTerm::NUMBER || t.type == RlTerm::STRING)
+      return token(t.name) ;
+
+    if(t.type == RlTerm::ATOM)
+    {
+      if(!arg && prec < 1200 && is_op(t.name))
+      {
+        token("(") ;
+        token(t.name) ;
+        out += ')' ;
+        return ;
+      }
+
+      return token(t.name) ;
+    }
+
+    if(t.type == RlTerm::LIST)
+    {
+      token("[") ;
+      args(t.args) ;
+      out += ']' ;
+      return ;
+    }
+
+    if(t.type == RlTerm::DICT)
+    {
+      token("_{") ;
+      args(t.args) ;
+      out += '}' ;
+      return ;
+    }
+
+    // {}(X)
+    if(t.name == "{}" && t.args.size() == 1)
+    {
+      token("{") ;
+      write(t.args[0], 1200) ;
+      out += '}' ;
+      return ;
+    }
+
+    // Infix operators
+    std::map<std::string, RlOp>::const_iterator op = infix_ops().find(t.name) ;
+    if(t.args.size() == 2 && op != infix_ops().end())
+    {
+      bool embrace = op->second.pri > prec ;
+      if(embrace)
+        token("(") ;
+
+      write(t.args[0], op->second.left) ;
+      if(t.name == ",")
+        out += ',' ;
+      else if(alnum(t.name[0]))
+      {
+        out += ' ' ;
+        out += t.name ;
+        out += ' ' ;
+      }
+      else
+        token(t.name) ;
+      write(t.args[1], op->second.right) ;
+
+      if(embrace)
+        out += ')' ;
+      return ;
+    }
+
+    // Prefix operators. -(1) is not written as -1, which would be a number.
+    op = prefix_ops().find(t.name) ;
+    if(t.args.size() == 1 && op != prefix_ops().end())
+    {
+      bool embrace = op->second.pri > prec ;
+      if(embrace)
+        token("(") ;
+
+      token(t.name) ;
+      const RlTerm& a = t.args[0] ;
+      if((t.name == "-" || t.name == "+") && a.type == RlTerm::NUMBER)
+      {
+        out += '(' ;
+        write(a, 999) ;
+        out += ')' ;
+      }
+      else
+      {
+        // A bracketed argument is glued to the operator like in term_string,
+        // -(1+2), unless it is a conjunction, which would be read as a
+        // compound with two arguments, \+ (a, b)
+        if(alnum(t.name[0]) || (a.type == RlTerm::COMPOUND && a.name == ","
+             && a.args.size() == 2 && infix_ops().at(",").pri > op->second.right))
+          out += ' ' ;
+        write(a, op->second.right) ;
+      }
+
+      if(embrace)
+        out += ')' ;
+      return ;
+    }
+
+    // Canonical f(a, b, c), also for zero arity f()
+    token(t.name) ;
+    out += '(' ;
+    args(t.args) ;
+    out += ')' ;
+  }
+
+  const std::string& str() const
+  {
+    return out ;
+  }
+} ;
+
+std::string portray_string(SEXP query, List options)
+{
+  RlWriter w ;
+  w.write(portray_term(query, options)) ;
+  return w.str() ;
+}
+
+// Lazy query attribute
+//
+// The attribute is an ALTREP string of length 1 that keeps the query and the
+// options (data1). The text is written on first access and then cached
+// (data2), so that the query is never written if the attribute is not read.
+static R_altrep_class_t portray_class ;
+
+static SEXP portray_materialize(SEXP x)
+{
+  SEXP s = R_altrep_data2(x) ;
+  if(s != R_NilValue)
+    return s ;
+
+  SEXP d = R_altrep_data1(x) ;
+  char msg[256] = "" ;
+  bool failed = false ;
+  try
+  {
+    std::string text = portray_string(VECTOR_ELT(d, 0), as<List>(VECTOR_ELT(d, 1))) ;
+    s = PROTECT(Rf_ScalarString(Rf_mkCharCE(text.c_str(), CE_UTF8))) ;
+  }
+
+  catch(std::exception& ex)
+  {
+    snprintf(msg, sizeof(msg), "%s", ex.what()) ;
+    failed = true ;
+  }
+
+  if(failed)
+    Rf_error("portray failed: %s", msg) ;
+
+  R_set_altrep_data2(x, s) ;
+  UNPROTECT(1) ;
+  return s ;
+}
+
+static R_xlen_t portray_length(SEXP x)
+{
+  return 1 ;
+}
+
+static SEXP portray_elt(SEXP x, R_xlen_t i)
+{
+  return STRING_ELT(portray_materialize(x), i) ;
+}
+
+static void portray_set_elt(SEXP x, R_xlen_t i, SEXP v)
+{
+  SET_STRING_ELT(portray_materialize(x), i, v) ;
+}
+
+static void* portray_dataptr(SEXP x, Rboolean writeable)
+{
+  return (void*) STRING_PTR_RO(portray_materialize(x)) ;
+}
+
+static const void* portray_dataptr_or_null(SEXP x)
+{
+  SEXP s = R_altrep_data2(x) ;
+  if(s == R_NilValue)
+    return NULL ;
+
+  return STRING_PTR_RO(s) ;
+}
+
+static Rboolean portray_inspect(SEXP x, int pre, int deep, int pvec, 
+  void (*inspect_subtree)(SEXP, int, int, int))
+{
+  Rprintf("rolog portray (%s)\n", R_altrep_data2(x) == R_NilValue ? "pending" : "written") ;
+  return TRUE ;
+}
+
+// Register the ALTREP class when the package is loaded
+//
+// [[Rcpp::init]]
+void portray_init(DllInfo* dll)
+{
+  portray_class = R_make_altstring_class("portray", "rolog", dll) ;
+  R_set_altrep_Length_method(portray_class, portray_length) ;
+  R_set_altrep_Inspect_method(portray_class, portray_inspect) ;
+  R_set_altvec_Dataptr_method(portray_class, portray_dataptr) ;
+  R_set_altvec_Dataptr_or_null_method(portray_class, portray_dataptr_or_null) ;
+  R_set_altstring_Elt_method(portray_class, portray_elt) ;
+  R_set_altstring_Set_elt_method(portray_class, portray_set_elt) ;
+}
+
+// Pretty print query
+//
+// [[Rcpp::export(.portray)]]
+CharacterVector portray_(RObject query, List options)
+{
+  return wrap(portray_string(query, options)) ;
+}
+
+// Same as portray_, but the text is only written when it is used. With the
+// simplified syntax, the symbols in (a) are evaluated immediately.
+//
+// [[Rcpp::export(.portray_lazy)]]
+RObject portray_lazy_(RObject query, List options)
+{
+  if(option_true(options, "simplified"))
+    return portray_(query, options) ;
+
+  return R_new_altrep(portray_class, List::create(query, options), R_NilValue) ;
+}
+
+// Performance counters, see rolog_statistics for prolog. Counts are returned
+// as doubles because they may exceed the range of R's integers.
+//
+// [[Rcpp::export(.stats)]]
+List stats_(bool reset)
+{
+  CharacterVector kinds(KIND_N) ;
+  DoubleVector r2pl_n(KIND_N), r2pl_s(KIND_N), pl2r_n(KIND_N), pl2r_s(KIND_N) ;
+  for(int i=0 ; i<KIND_N ; i++)
+  {
+    kinds(i) = kind_names[i] ;
+    r2pl_n(i) = rolog_stats.r2pl[i].n.load() ;
+    r2pl_s(i) = rolog_stats.r2pl[i].ns.load() / 1e9 ;
+    pl2r_n(i) = rolog_stats.pl2r[i].n.load() ;
+    pl2r_s(i) = rolog_stats.pl2r[i].ns.load() / 1e9 ;
+  }
+
+  DataFrame query = DataFrame::create(
+    Named("event") = CharacterVector::create("open", "next", "close"),
+    Named("count") = DoubleVector::create((double) rolog_stats.open.n.load(), 
+      (double) rolog_stats.next.n.load(), (double) rolog_stats.close.n.load()),
+    Named("seconds") = DoubleVector::create(rolog_stats.open.ns.load() / 1e9,
+      rolog_stats.next.ns.load() / 1e9, rolog_stats.close.ns.load() / 1e9)) ;
+
+  DoubleVector hist(HIST_N) ;
+  CharacterVector bins(HIST_N) ;
+  for(int i=0 ; i<HIST_N ; i++)
+  {
+    hist(i) = rolog_stats.r_eval_hist[i].load() ;
+    bins(i) = std::string("<") + std::to_string(1ULL << i) + "us" ;
+  }
+  hist.names() = bins ;
+
+  List l = List::create(
+    Named("r2pl") = DataFrame::create(Named("kind") = kinds, 
+      Named("count") = r2pl_n, Named("seconds") = r2pl_s),
+    Named("pl2r") = DataFrame::create(Named("kind") = kinds, 
+      Named("count") = pl2r_n, Named("seconds") = pl2r_s),
+    Named("query") = query,
+    Named("solutions") = DoubleVector::create(Named("total") = (double) rolog_stats.solutions.load(),
+      Named("max") = (double) rolog_stats.max_solutions.load()),
+    Named("inferences") = DoubleVector::create(Named("total") = (double) rolog_stats.inferences.load(),
+      Named("max") = (double) rolog_stats.max_inferences.load()),
+    Named("stack") = DoubleVector::create(Named("max") = (double) rolog_stats.max_stack.load()),
+    Named("r_eval") = List::create(Named("count") = (double) rolog_stats.r_eval.n.load(),
+      Named("seconds") = rolog_stats.r_eval.ns.load() / 1e9, Named("histogram") = hist)) ;
+
+  if(reset)
+    rolog_stats.reset() ;
+
+  return l ;
+}
+
+// Start or stop tracing, see rolog_trace
+//
+// [[Rcpp::export(.trace)]]
+LogicalVector trace_(bool on, int size)
+{
+  if(on && size <= 0)
+    stop("rolog_trace: size must be positive") ;
+
+  trace_enable(on, on ? size : 0) ;
+  return true ;
+}
+
+// Write the trace, returns the number of spans
+//
+// [[Rcpp::export(.trace_write)]]
+double trace_write_(String fname)
+{
+  long n = trace_write(fname.get_cstring()) ;
+  if(n < 0)
+    stop("rolog_trace_write: cannot open %s", fname.get_cstring()) ;
+
+  return n ;
+}
+
+// Execute a query given as a string
+//
+// Example:
+// once("use_module(library(http/html_write))")
+//
+// [[Rcpp::export(.call)]]
 RObject call_(String query)
 {
-  if(PL_current_query() != 0)
+  // Nested in an open query, if any
+  bool r = false ;
+  try
+  {
+    r = PlCall(query.get_cstring()) ;
+  }
+  
+  catch(PlException& ex)
+  {
+    warning(ex.as_string(PlEncoding::Locale).c_str()) ;
+    PL_clear_exception() ;
+    stop("query failed: %s", query.get_cstring()) ;
+  }
+  
+  return wrap(r) ;
+}
+
+// Prolog thread of R, see init_. R must not be called from other threads,
+// e.g., in background queries (query_async).
+static int pl_main_thread = 0 ;
+
+static void check_main_thread()
+{
+  if(PL_thread_self() != pl_main_thread)
+    throw PlException(PlTerm_string("r_eval: R cannot be called from background threads")) ;
+}
+
+// Call R expression from Prolog
+PREDICATE(r_eval, 1)
+{
+  check_main_thread() ;
+  RlEvalTimer t ;
+  RlSpanTimer span("r_eval", "r_eval") ;
+  RlQueryLevel level ;
+  CharacterVector names ;
+  PlTerm_var vars ;
+  List options ;
+  if(innermost_options())
+    options = *innermost_options() ;
+  else
+    options = List::create(Named("realvec") = "##", Named("realmat") = "###",
+      Named("boolvec") = "!!", Named("boolmat") = "!!!",
+      Named("charvec") = "$$", Named("charmat") = "$$$",
+      Named("intvec") = "%%", Named("intmat") = "%%%", 
+      Named("atomize") = false, Named("scalar") = true,
+      Named("codecs") = true) ;
+
+  RlSpanTimer conv("pl2r", "r_eval") ;
+  RObject Expr = pl2r_transfer(A1, names, vars, eval_options(options)) ;
+  conv.stop() ;
+  RObject Res = Expr ;
+  RlSpanTimer eval("eval", "r_eval") ;
+  try
+  {
+    Language id("dontCheck") ;
+    id.push_back(Expr) ;
+    Res = id.eval() ;
+  }
+
+  catch(std::exception& ex)
+  {
+    throw PlException(PlCompound("r_eval1", PlTermv(A1, PlTerm_atom(ex.what())))) ;
+  }
+
+  return true ;
+}
+
+// Evaluate R expression from Prolog
+PREDICATE(r_eval, 2)
+{
+  check_main_thread() ;
+  RlEvalTimer t ;
+  RlSpanTimer span("r_eval", "r_eval") ;
+  RlQueryLevel level ;
+  CharacterVector names ;
+  PlTerm_var vars ;
+  List options ;
+  if(innermost_options())
+    options = *innermost_options() ;
+  else
+    options = List::create(Named("realvec") = "#", Named("realmat") = "##",
+      Named("boolvec") = "!", Named("boolmat") = "!!",
+      Named("charvec") = "$$", Named("charmat") = "$$$",
+      Named("intvec") = "%", Named("intmat") = "%%", 
+      Named("atomize") = false, Named("scalar") = true,
+      Named("codecs") = true) ;
+ 
+  RlSpanTimer conv("pl2r", "r_eval") ;
+  RObject Expr = pl2r_transfer(A1, names, vars, eval_options(options)) ;
+  conv.stop() ;
+  RObject Res = Expr ;
+  RlSpanTimer eval("eval", "r_eval") ;
+  try
+  {
+    Language id("dontCheck") ;
+    id.push_back(Expr) ;
+    Res = id.eval() ;
+  }
+  
+  catch(std::exception& ex)
+  {
+    throw PlException(PlCompound("r_eval2", PlTermv(A1, PlTerm_atom(ex.what())))) ;
+  }
+
+  eval.stop() ;
+  PlTerm_var pl ;
+  try
+  {
+    RlSpanTimer back("r2pl", "r_eval") ;
+    PlCheckFail(pl.unify_term(r2pl_transfer(Res, names, vars, options))) ;
+  }
+  
+  catch(std::exception& ex)
+  {
+    throw PlException(PlCompound("r_eval2", PlTermv(A1, PlTerm_atom(ex.what())))) ;
+  }
+
+  return A2.unify_term(pl) ;
+}
+
+// The SWI system should not be initialized twice; therefore, we keep track of
+// its status.
+bool pl_initialized = false ;
+
+// Initialize SWI-prolog. This needs a list of the command-line arguments of 
+// the calling program, the most important being the name of the main 
+// executable, argv[0]. I added "-q" to suppress SWI prolog's welcome message
+// which is shown in .onAttach anyway.
+//
+// If state is not empty, prolog boots from the saved state given there (see
+// rolog_save_state), that is, with all libraries and rules already loaded.
+//
+// [[Rcpp::export(.init)]]
+LogicalVector init_(String argv0, String state)
+{
+  if(pl_initialized)
+    warning("Please do not initialize SWI-prolog twice in the same session.") ;
+  
+  // Prolog documentation requires that argv is accessible during the entire 
+  // session. I assume that this pointer is valid during the whole R session,
+  // and that I can safely cast it to const. The name of the saved state is 
+  // kept in a static variable for the same reason.
+  static std::string state_ ;
+  state_ = state.get_cstring() ;
+
+  int argc = 0 ;
+  const char* argv[4] ;
+  argv[argc++] = argv0.get_cstring() ;
+  if(!state_.empty())
+  {
+    argv[argc++] = "-x" ;
+    argv[argc++] = state_.c_str() ;
+  }
+
+  argv[argc++] = "-q" ;
+  if(!PL_initialise(argc, (char**) argv))
+    stop("rolog_init: initialization failed.") ;
+
+  pl_initialized = true ;  
+  pl_main_thread = PL_thread_self() ;
+
+  // Called by the alarm of the running query, see RlWatchdog
+  time_loaded = false ;
+  PL_register_foreign("rolog_watchdog", 0, (pl_function_t) rolog_watchdog, 0) ;
+  return true ;
+}
+
+// [[Rcpp::export(.done)]]
+LogicalVector done_()
+{
+  if(!pl_initialized)
   {
-    warning("Closing the current query.") ;
+    warning("rolog_done: swipl has not been initialized") ;
+    return true ;
+  }
+
+  // Just in case there are open queries
+  while(current_query())
     clear_() ;
+
+  while(!async_queries.empty())
+    cancel_(async_queries.begin()->first) ;
+
+  PL_cleanup(0) ;
+  pl_initialized = false ;
+  return true ;
+}
+
+#endif // RPACKAGE
+ 
+#ifdef PROLOGPACK
+
+#include "SWI-cpp2.h"
+#include "RInside.h"
+
+RInside* r_instance = NULL ;
+
+// Options for the translation from and to R, see rolog_options in R
+static List r_eval_options()
+{
+  return List::create(
+    Named("realvec") = "##", Named("realmat") = "###",
+    Named("boolvec") = "!!", Named("boolmat") = "!!!",
+    Named("charvec") = "$$", Named("charmat") = "$$$",
+    Named("intvec") = "%%", Named("intmat") = "%%%",
+    Named("atomize") = false, Named("scalar") = true,
+    Named("codecs") = true, Named("rewrite") = true,
+    Named("transfer") = "default") ;
+}
+
+PREDICATE(r_init_, 0)
+{
+  if(r_instance)
+    return true ;
+
+  static int argc ;
+  static char** argv ;
+  if(!PL_is_initialised(&argc, &argv))
+  {
+    throw PlException(PlTerm_string("Prolog not initialized. Exiting.")) ;
+    return false ;
   }
 
-  bool r = false ;
+  r_instance = new RInside(argc, argv) ;
+  return true ;
+}
+
+PREDICATE(r_eval_, 1)
+{
+  if(!R_TempDir)
+    throw PlException(PlTerm_string("R not initialized. Please invoke r_init.")) ;
+
+  RlEvalTimer t ;
+  RlSpanTimer span("r_eval_", "r_eval") ;
+  CharacterVector names ;
+  PlTerm_var vars ;
+  List options = r_eval_options() ;
+
+  RlSpanTimer conv("pl2r", "r_eval") ;
+  RObject Expr = pl2r(A1, names, vars, eval_options(options)) ;
+  conv.stop() ;
+  RObject Res = Expr ;
+  RlSpanTimer eval("eval", "r_eval") ;
   try
   {
-    r = PlCall(query.get_cstring()) ;
+    Language id("identity") ;
+    id.push_back(Expr) ;
+    Res = Rcpp_eval(id, Environment::global_env()) ;
   }
-  
-  catch(PlException& ex)
+
+  catch(const Rcpp::eval_error& ex)
   {
-    warning(ex.as_string(PlEncoding::Locale).c_str()) ;
-    PL_clear_exception() ;
-    stop("query failed: %s", query.get_cstring()) ;
+    PlCompound syntax("evaluation_error", PlTermv(A1)) ;
+    PlCompound context("context", PlTermv(PlTerm_string("foreign r_eval_/2"), PlTerm_string(ex.what()))) ;
+    throw PlException(PlCompound("error", PlTermv(syntax, context))) ;
   }
   
-  return wrap(r) ;
+  catch(const std::exception& ex)
+  {
+    PlCompound syntax("evaluation_error", PlTermv(A1)) ;
+    PlCompound context("context", PlTermv(PlTerm_string("foreign r_eval_/2"), PlTerm_string(ex.what()))) ;
+    throw PlException(PlCompound("error", PlTermv(syntax, context))) ;
+  }
+
+  catch(...)
+  {
+    throw PlException(PlTerm_string("unknown exception")) ;
+    return false ;
+  }
+
+  return true ;
 }
 
-// Call R expression from Prolog
-PREDICATE(r_eval, 1)
+// Evaluate Expr in R and unify the result with Res
+static bool r_eval_term(PlTerm expr, PlTerm res, List options)
 {
+  if(!R_TempDir)
+    throw PlException(PlTerm_string("R not initialized. Please invoke r_init.")) ;
+
+  RlEvalTimer t ;
+  RlSpanTimer span("r_eval_", "r_eval") ;
   CharacterVector names ;
   PlTerm_var vars ;
-  List options ;
-  if(query_id)
-    options = query_id->get_options() ;
-  else
-    options = List::create(Named("realvec") = "##", Named("realmat") = "###",
-      Named("boolvec") = "!!", Named("boolmat") = "!!!",
-      Named("charvec") = "$$", Named("charmat") = "$$$",
-      Named("intvec") = "%%", Named("intmat") = "%%%", 
-      Named("atomize") = false, Named("scalar") = true) ;
 
-  RObject Expr = pl2r(A1, names, vars, options) ;
-  RObject Res = Expr ;
-  try
+  RlSpanTimer conv("pl2r", "r_eval") ;
+  RObject Expr = pl2r_transfer(expr, names, vars, eval_options(options)) ;
+  conv.stop() ;
+  RObject Res = Expr ;
+  RlSpanTimer eval("eval", "r_eval") ;
+  try
+  {
+    Language id("identity") ;
+    id.push_back(Expr) ;
+    Res = Rcpp_eval(id, Environment::global_env()) ;
+  }
+
+  catch(const Rcpp::eval_error& ex)
+  {
+    PlCompound syntax("evaluation_error", PlTermv(expr)) ;
+    PlCompound context("context", PlTermv(PlTerm_string("foreign r_eval_/2"), PlTerm_string(ex.what()))) ;
+    throw PlException(PlCompound("error", PlTermv(syntax, context))) ;
+  }
+
+  catch(const std::exception& ex)
+  {
+    PlCompound syntax("evaluation_error", PlTermv(expr)) ;
+    PlCompound context("context", PlTermv(PlTerm_string("foreign r_eval_/2"), PlTerm_string(ex.what()))) ;
+    throw PlException(PlCompound("error", PlTermv(syntax, context))) ;
+  }
+
+  catch(...)
+  {
+    throw PlException(PlTerm_string("unknown exception")) ;
+    return false ;
+  }
+
+  eval.stop() ;
+  try
+  {
+    RlSpanTimer back("r2pl", "r_eval") ;
+    if(!res.unify_term(r2pl_transfer(Res, names, vars, options)))
+    {
+      throw PlException(PlTerm_string("r_eval/2: Cannot unify R object.")) ;
+      return false ;
+    }
+  }
+
+  catch(std::exception& ex)
+  {
+    throw PlException(PlTerm_string(ex.what())) ;
+    return false ;
+  }
+
+  catch(...)
+  {
+    throw PlException(PlTerm_string("unknown exception1")) ;
+    return false ;
+  }
+
+  return true ;
+}
+
+PREDICATE(r_eval_, 2)
+{
+  return r_eval_term(A1, A2, r_eval_options()) ;
+}
+
+// r_eval_(+Expr, -Res, +Transfer), see r_eval/3
+PREDICATE(r_eval_, 3)
+{
+  List options = r_eval_options() ;
+  options("transfer") = A3.as_string() ;
+  return r_eval_term(A1, A2, options) ;
+}
+
+// r_trace_now_(-T) and r_trace_mutex_(+T): time spent waiting for the mutex
+// rolog, see with_rolog/1 in rolog.pl. T is -1 if tracing is off.
+PREDICATE(r_trace_now_, 1)
+{
+  return PL_unify_int64(A1.C_, trace_on ? trace_now() : -1) ;
+}
+
+PREDICATE(r_trace_mutex_, 1)
+{
+  int64_t t0 ;
+  PlCheckFail(PL_get_int64_ex(A1.C_, &t0)) ;
+  if(t0 >= 0 && trace_on)
+    trace_span("mutex", "r_eval", t0, trace_now()) ;
+
+  return true ;
+}
+
+// r_stream_(+Expr, +Chunk, -List): evaluate Expr and return the result as a
+// lazy list, see r_stream/3
+PREDICATE(r_stream_, 3)
+{
+  if(!R_TempDir)
+    throw PlException(PlTerm_string("R not initialized. Please invoke r_init.")) ;
+
+  RlEvalTimer t ;
+  CharacterVector names ;
+  PlTerm_var vars ;
+  List options = r_eval_options() ;
+
+  RObject Expr = pl2r(A1, names, vars, eval_options(options)) ;
+  RObject Res ;
+  try
+  {
+    Language id("identity") ;
+    id.push_back(Expr) ;
+    Res = Rcpp_eval(id, Environment::global_env()) ;
+  }
+
+  catch(const std::exception& ex)
+  {
+    PlCompound syntax("evaluation_error", PlTermv(A1)) ;
+    PlCompound context("context", PlTermv(PlTerm_string("foreign r_stream_/3"), PlTerm_string(ex.what()))) ;
+    throw PlException(PlCompound("error", PlTermv(syntax, context))) ;
+  }
+
+  int64_t chunk ;
+  PlCheckFail(PL_get_int64_ex(A2.C_, &chunk)) ;
+  return A3.unify_term(r2pl_stream(Res, chunk, options)) ;
+}
+
+#ifndef _WIN32
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <semaphore.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <R_ext/Visibility.h>
+
+extern char** environ ;
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Pool of R workers
+//
+// r_init/1 with the option workers(N) starts N R processes with Rscript.
+// Each worker loads this library and calls rolog_worker_ with the name of a
+// shared memory object that holds two ring buffers. r_pool_eval/2 translates
+// the expression to R in the main process, serializes it in R's binary format
+// and sends it to an idle worker. The worker evaluates the expression and
+// sends back the serialized result the same way. Translation still needs the
+// mutex rolog, but evaluation runs in parallel in the workers.
+//
+// The workers are spawned and not forked, because the main process already
+// runs several threads when r_init/1 is called. They are fresh R sessions
+// and do not see the state of the embedded R, which is why r_eval/2 and
+// r_call/1 stay with the embedded R.
+//
+// Waits on the rings are done in slices, with a check whether the process on
+// the other end is still alive. A worker that dies is taken out of the pool,
+// and a worker ends when the main process is gone.
+
+// Interval for the checks, in nanoseconds
+static const long r_pool_slice = 100000000 ;
+
+// The other end of a ring is the parent process (in the worker) or a child
+// (in the main process). A dead child is reaped here.
+static bool r_alive(pid_t peer)
+{
+  if(peer == getppid())
+    return true ;
+
+  return waitpid(peer, NULL, WNOHANG) == 0 ;
+}
+
+// Ring buffer in shared memory with a single writer and a single reader
+struct RlRing
+{
+  std::atomic<uint64_t> head ;  // bytes written
+  std::atomic<uint64_t> tail ;  // bytes read
+  sem_t data ;                  // posted after writing
+  sem_t space ;                 // posted after reading
+  uint64_t size ;               // followed by size bytes
+
+  char* buf()
+  {
+    return reinterpret_cast<char*>(this + 1) ;
+  }
+
+  // Fails if process-shared semaphores are not supported (e.g., macOS)
+  bool init(uint64_t asize)
+  {
+    head = 0 ;
+    tail = 0 ;
+    size = asize ;
+    return sem_init(&data, 1, 0) == 0 && sem_init(&space, 1, 0) == 0 ;
+  }
+
+  // Fails if the process on the other end is gone
+  static bool wait(sem_t* s, pid_t peer)
+  {
+    while(true)
+    {
+      struct timespec t ;
+      clock_gettime(CLOCK_REALTIME, &t) ;
+      t.tv_nsec += r_pool_slice ;
+      if(t.tv_nsec >= 1000000000)
+      {
+        t.tv_sec++ ;
+        t.tv_nsec -= 1000000000 ;
+      }
+
+      if(sem_timedwait(s, &t) == 0)
+        return true ;
+
+      if(errno == ETIMEDOUT && !r_alive(peer))
+        return false ;
+    }
+  }
+
+  bool write(const char* p, uint64_t n, pid_t peer)
+  {
+    while(n)
+    {
+      uint64_t h = head.load(std::memory_order_relaxed) ;
+      uint64_t free = size - (h - tail.load(std::memory_order_acquire)) ;
+      if(free == 0)
+      {
+        if(!wait(&space, peer))
+          return false ;
+        continue ;
+      }
+
+      uint64_t off = h % size ;
+      uint64_t k = std::min(std::min(n, free), size - off) ;
+      memcpy(buf() + off, p, k) ;
+      head.store(h + k, std::memory_order_release) ;
+      sem_post(&data) ;
+      p += k ;
+      n -= k ;
+    }
+
+    return true ;
+  }
+
+  bool read(char* p, uint64_t n, pid_t peer)
+  {
+    while(n)
+    {
+      uint64_t t = tail.load(std::memory_order_relaxed) ;
+      uint64_t avail = head.load(std::memory_order_acquire) - t ;
+      if(avail == 0)
+      {
+        if(!wait(&data, peer))
+          return false ;
+        continue ;
+      }
+
+      uint64_t off = t % size ;
+      uint64_t k = std::min(std::min(n, avail), size - off) ;
+      memcpy(p, buf() + off, k) ;
+      tail.store(t + k, std::memory_order_release) ;
+      sem_post(&space) ;
+      p += k ;
+      n -= k ;
+    }
+
+    return true ;
+  }
+
+  // Messages are a length, a status byte (0 = ok), and the data
+  bool send(uint8_t status, const std::vector<char>& msg, pid_t peer)
   {
-    Language id("dontCheck") ;
-    id.push_back(Expr) ;
-    Res = id.eval() ;
+    uint64_t n = msg.size() ;
+    return write((const char*) &n, sizeof(n), peer)
+      && write((const char*) &status, 1, peer)
+      && write(msg.data(), n, peer) ;
   }
 
-  catch(std::exception& ex)
+  bool receive(uint8_t& status, std::vector<char>& msg, pid_t peer)
   {
-    throw PlException(PlCompound("r_eval1", PlTermv(A1, PlTerm_atom(ex.what())))) ;
+    uint64_t n ;
+    if(!read((char*) &n, sizeof(n), peer) || !read((char*) &status, 1, peer))
+      return false ;
+    msg.resize(n) ;
+    return read(msg.data(), n, peer) ;
   }
+} ;
 
-  return true ;
+// Two rings, for the requests and the replies, in one shared memory object
+static size_t r_ring_bytes(uint64_t size)
+{
+  return (sizeof(RlRing) + size + 63) / 64 * 64 ;
 }
 
-// Evaluate R expression from Prolog
-PREDICATE(r_eval, 2)
+// Serialization to and from memory, with R errors caught by R_ToplevelExec
+struct RlSerial
 {
-  CharacterVector names ;
-  PlTerm_var vars ;
-  List options ;
-  if(query_id)
-    options = query_id->get_options() ;
-  else
-    options = List::create(Named("realvec") = "#", Named("realmat") = "##",
-      Named("boolvec") = "!", Named("boolmat") = "!!",
-      Named("charvec") = "$$", Named("charmat") = "$$$",
-      Named("intvec") = "%", Named("intmat") = "%%", 
-      Named("atomize") = false, Named("scalar") = true) ;
- 
-  RObject Expr = pl2r(A1, names, vars, options) ;
-  RObject Res = Expr ;
-  try
-  {
-    Language id("dontCheck") ;
-    id.push_back(Expr) ;
-    Res = id.eval() ;
-  }
-  
-  catch(std::exception& ex)
-  {
-    throw PlException(PlCompound("r_eval2", PlTermv(A1, PlTerm_atom(ex.what())))) ;
-  }
+  SEXP x ;
+  std::vector<char>* msg ;
+  size_t pos ;
+} ;
 
-  PlTerm_var pl ;
-  try
-  {
-    PlCheckFail(pl.unify_term(r2pl(Res, names, vars, options))) ;
-  }
-  
-  catch(std::exception& ex)
-  {
-    throw PlException(PlCompound("r_eval2", PlTermv(A1, PlTerm_atom(ex.what())))) ;
-  }
+static void serial_out_char(R_outpstream_t s, int c)
+{
+  static_cast<RlSerial*>(s->data)->msg->push_back((char) c) ;
+}
 
-  return A2.unify_term(pl) ;
+static void serial_out_bytes(R_outpstream_t s, void* p, int n)
+{
+  std::vector<char>* msg = static_cast<RlSerial*>(s->data)->msg ;
+  msg->insert(msg->end(), (char*) p, (char*) p + n) ;
 }
 
-// The SWI system should not be initialized twice; therefore, we keep track of
-// its status.
-bool pl_initialized = false ;
+static int serial_in_char(R_inpstream_t s)
+{
+  RlSerial* d = static_cast<RlSerial*>(s->data) ;
+  if(d->pos >= d->msg->size())
+    Rf_error("r_eval: truncated message") ;
+  return (unsigned char) (*d->msg)[d->pos++] ;
+}
 
-// Initialize SWI-prolog. This needs a list of the command-line arguments of 
-// the calling program, the most important being the name of the main 
-// executable, argv[0]. I added "-q" to suppress SWI prolog's welcome message
-// which is shown in .onAttach anyway.
-// [[Rcpp::export(.init)]]
-LogicalVector init_(String argv0)
+static void serial_in_bytes(R_inpstream_t s, void* p, int n)
 {
-  if(pl_initialized)
-    warning("Please do not initialize SWI-prolog twice in the same session.") ;
-  
-  // Prolog documentation requires that argv is accessible during the entire 
-  // session. I assume that this pointer is valid during the whole R session,
-  // and that I can safely cast it to const.
-  const int argc = 2 ;
-  const char* argv[argc] ;
-  argv[0] = argv0.get_cstring() ;
-  argv[1] = "-q" ;
-  if(!PL_initialise(argc, (char**) argv))
-    stop("rolog_init: initialization failed.") ;
+  RlSerial* d = static_cast<RlSerial*>(s->data) ;
+  if(d->pos + n > d->msg->size())
+    Rf_error("r_eval: truncated message") ;
+  memcpy(p, d->msg->data() + d->pos, n) ;
+  d->pos += n ;
+}
 
-  pl_initialized = true ;  
-  return true ;
+static void serialize_top(void* data)
+{
+  struct R_outpstream_st s ;
+  R_InitOutPStream(&s, (R_pstream_data_t) data, R_pstream_binary_format, 3,
+    serial_out_char, serial_out_bytes, NULL, R_NilValue) ;
+  R_Serialize(static_cast<RlSerial*>(data)->x, &s) ;
 }
 
-// [[Rcpp::export(.done)]]
-LogicalVector done_()
+static void unserialize_top(void* data)
 {
-  if(!pl_initialized)
-  {
-    warning("rolog_done: swipl has not been initialized") ;
-    return true ;
-  }
+  struct R_inpstream_st s ;
+  R_InitInPStream(&s, (R_pstream_data_t) data, R_pstream_binary_format,
+    serial_in_char, serial_in_bytes, NULL, R_NilValue) ;
+  RlSerial* d = static_cast<RlSerial*>(data) ;
+  d->x = R_Unserialize(&s) ;
+  R_PreserveObject(d->x) ;
+}
 
-  // Just in case there are open queries
-  clear_() ;
+static bool r_serialize(SEXP x, std::vector<char>& msg)
+{
+  RlSerial d = { x, &msg, 0 } ;
+  msg.clear() ;
+  return R_ToplevelExec(serialize_top, &d) ;
+}
 
-  PL_cleanup(0) ;
-  pl_initialized = false ;
+// The result must be released with R_ReleaseObject
+static bool r_unserialize(std::vector<char>& msg, SEXP& x)
+{
+  RlSerial d = { R_NilValue, &msg, 0 } ;
+  if(!R_ToplevelExec(unserialize_top, &d))
+    return false ;
+
+  x = d.x ;
   return true ;
 }
 
-#endif // RPACKAGE
- 
-#ifdef PROLOGPACK
-
-#include "SWI-cpp2.h"
-#include "RInside.h"
+static void r_message(std::vector<char>& msg, const char* text)
+{
+  msg.assign(text, text + strlen(text)) ;
+}
 
-RInside* r_instance = NULL ;
+// Message of the last R error, from geterrmessage()
+static void r_error_message(std::vector<char>& msg)
+{
+  int err = 0 ;
+  SEXP call = PROTECT(Rf_lang1(Rf_install("geterrmessage"))) ;
+  SEXP m = PROTECT(R_tryEval(call, R_BaseEnv, &err)) ;
+  if(!err && TYPEOF(m) == STRSXP && XLENGTH(m) > 0)
+    r_message(msg, CHAR(STRING_ELT(m, 0))) ;
+  else
+    r_message(msg, "error in R worker") ;
+  UNPROTECT(2) ;
+}
 
-PREDICATE(r_init_, 0)
+// Main loop of the worker. The worker does not use prolog.
+static void r_worker(RlRing* request, RlRing* reply, pid_t parent)
 {
-  if(r_instance)
-    return true ;
+  std::vector<char> msg ;
+  uint8_t status ;
 
-  static int argc ;
-  static char** argv ;
-  if(!PL_is_initialised(&argc, &argv))
+  // Tell the main process that the worker is ready
+  if(!reply->send(0, msg, parent))
+    return ;
+
+  while(true)
   {
-    throw PlException(PlTerm_string("Prolog not initialized. Exiting.")) ;
-    return false ;
+    // Empty message: shutdown
+    if(!request->receive(status, msg, parent) || msg.empty())
+      return ;
+
+    SEXP expr ;
+    if(!r_unserialize(msg, expr))
+    {
+      r_message(msg, "cannot unserialize expression") ;
+      if(!reply->send(1, msg, parent))
+        return ;
+      continue ;
+    }
+
+    int err = 0 ;
+    SEXP call = PROTECT(Rf_lang2(Rf_install("identity"), expr)) ;
+    SEXP res = PROTECT(R_tryEval(call, R_GlobalEnv, &err)) ;
+    R_ReleaseObject(expr) ;
+    if(err)
+      r_error_message(msg) ;
+    else if(!r_serialize(res, msg))
+    {
+      r_message(msg, "cannot serialize result") ;
+      err = 1 ;
+    }
+
+    UNPROTECT(2) ;
+    if(!reply->send(err ? 1 : 0, msg, parent))
+      return ;
   }
+}
 
-  r_instance = new RInside(argc, argv) ;
-  return true ;
+// Entry point of the worker, called from Rscript by .Call, see
+// r_pool_init_. Returns when the main process stops the worker or is gone.
+extern "C" attribute_visible SEXP rolog_worker_(SEXP name)
+{
+  int fd = shm_open(CHAR(STRING_ELT(name, 0)), O_RDWR, 0) ;
+  if(fd == -1)
+    Rf_error("rolog_worker_: cannot open shared memory") ;
+
+  struct stat st ;
+  void* mem = MAP_FAILED ;
+  if(fstat(fd, &st) == 0)
+    mem = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) ;
+  close(fd) ;
+  if(mem == MAP_FAILED)
+    Rf_error("rolog_worker_: cannot map shared memory") ;
+
+  RlRing* request = static_cast<RlRing*>(mem) ;
+  RlRing* reply = reinterpret_cast<RlRing*>((char*) mem + r_ring_bytes(request->size)) ;
+  r_worker(request, reply, getppid()) ;
+  munmap(mem, st.st_size) ;
+  return R_NilValue ;
 }
 
-PREDICATE(r_eval_, 1)
+// Workers, as seen from the main process
+struct RlWorker
 {
-  if(!R_TempDir)
-    throw PlException(PlTerm_string("R not initialized. Please invoke r_init.")) ;
+  pid_t pid ;
+  std::string name ;            // of the shared memory object
+  void* mem ;
+  size_t bytes ;
+  RlRing* request ;
+  RlRing* reply ;
+  bool busy ;
+  bool dead ;
+  uint8_t status ;
+  std::vector<char> msg ;
+} ;
 
-  CharacterVector names ;
-  PlTerm_var vars ;
-  List options ;
-  options = List::create(
-    Named("realvec") = "##", Named("realmat") = "###",
-    Named("boolvec") = "!!", Named("boolmat") = "!!!",
-    Named("charvec") = "$$", Named("charmat") = "$$$",
-    Named("intvec") = "%%", Named("intmat") = "%%%",
-    Named("atomize") = false, Named("scalar") = true) ;
+static std::vector<RlWorker> r_workers ;
+static std::mutex r_pool_mutex ;
+static std::condition_variable r_pool_idle ;
 
-  RObject Expr = pl2r(A1, names, vars, options) ;
-  RObject Res = Expr ;
-  try
-  {
-    Language id("identity") ;
-    id.push_back(Expr) ;
-    Res = Rcpp_eval(id, Environment::global_env()) ;
-  }
+static RlWorker& r_worker_arg(PlTerm w)
+{
+  int i ;
+  if(!PL_get_integer(w.C_, &i) || i < 0 || i >= (int) r_workers.size())
+    throw PlException(PlTerm_string("r_pool_eval: invalid worker")) ;
+  return r_workers[i] ;
+}
 
-  catch(const Rcpp::eval_error& ex)
-  {
-    PlCompound syntax("evaluation_error", PlTermv(A1)) ;
-    PlCompound context("context", PlTermv(PlTerm_string("foreign r_eval_/2"), PlTerm_string(ex.what()))) ;
-    throw PlException(PlCompound("error", PlTermv(syntax, context))) ;
-  }
-  
-  catch(const std::exception& ex)
+// Ask the worker to exit, or kill it if it is busy, and release the shared
+// memory
+static void r_worker_stop(RlWorker& w)
+{
+  if(w.pid > 0 && !w.dead)
   {
-    PlCompound syntax("evaluation_error", PlTermv(A1)) ;
-    PlCompound context("context", PlTermv(PlTerm_string("foreign r_eval_/2"), PlTerm_string(ex.what()))) ;
-    throw PlException(PlCompound("error", PlTermv(syntax, context))) ;
+    std::vector<char> empty ;
+    if(w.busy || !w.request->send(0, empty, w.pid))
+      kill(w.pid, SIGTERM) ;
+    waitpid(w.pid, NULL, 0) ;
   }
 
-  catch(...)
-  {
-    throw PlException(PlTerm_string("unknown exception")) ;
-    return false ;
-  }
+  shm_unlink(w.name.c_str()) ;
+  munmap(w.mem, w.bytes) ;
+}
 
-  return true ;
+static void r_pool_stop()
+{
+  for(size_t i=0 ; i<r_workers.size() ; i++)
+    r_worker_stop(r_workers[i]) ;
+  r_workers.clear() ;
 }
 
-PREDICATE(r_eval_, 2)
+// Stop the workers that have been started so far
+static void r_pool_fail(const char* msg)
+{
+  r_pool_stop() ;
+  throw PlException(PlTerm_string(msg)) ;
+}
+
+// r_pool_init_(+N, +Size, +Rscript, +Library)
+PREDICATE(r_pool_init_, 4)
 {
   if(!R_TempDir)
     throw PlException(PlTerm_string("R not initialized. Please invoke r_init.")) ;
 
-  CharacterVector names ;
-  PlTerm_var vars ;
-  List options ;
-  options = List::create(
-    Named("realvec") = "##", Named("realmat") = "###",
-    Named("boolvec") = "!!", Named("boolmat") = "!!!",
-    Named("charvec") = "$$", Named("charmat") = "$$$",
-    Named("intvec") = "%%", Named("intmat") = "%%%",
-    Named("atomize") = false, Named("scalar") = true) ;
+  if(!r_workers.empty())
+    return true ;
 
-  RObject Expr = pl2r(A1, names, vars, options) ;
-  RObject Res = Expr ;
-  try
+  int n ;
+  int64_t size ;
+  if(!PL_get_integer(A1.C_, &n) || n <= 0 || !PL_get_int64(A2.C_, &size) || size <= 0)
+    throw PlException(PlTerm_string("r_init: invalid number of workers or buffer size")) ;
+
+  std::string rscript = A3.as_string(PlEncoding::Locale) ;
+  std::string lib = A4.as_string(PlEncoding::Locale) ;
+  size_t ring = r_ring_bytes((uint64_t) size) ;
+  for(int i=0 ; i<n ; i++)
   {
-    Language id("identity") ;
-    id.push_back(Expr) ;
-    Res = Rcpp_eval(id, Environment::global_env()) ;
+    RlWorker w ;
+    w.pid = 0 ;
+    w.name = "/rolog." + std::to_string(getpid()) + "." + std::to_string(i) ;
+    w.bytes = 2 * ring ;
+    w.busy = false ;
+    w.dead = false ;
+    w.status = 0 ;
+
+    int fd = shm_open(w.name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600) ;
+    if(fd == -1)
+      r_pool_fail("r_init: cannot create shared memory") ;
+
+    w.mem = MAP_FAILED ;
+    if(ftruncate(fd, w.bytes) == 0)
+      w.mem = mmap(NULL, w.bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) ;
+    close(fd) ;
+    if(w.mem == MAP_FAILED)
+    {
+      shm_unlink(w.name.c_str()) ;
+      r_pool_fail("r_init: cannot allocate shared memory") ;
+    }
+
+    // From here on, r_pool_stop cleans up
+    w.request = new(w.mem) RlRing ;
+    w.reply = new((char*) w.mem + ring) RlRing ;
+    bool ok = w.request->init((uint64_t) size) && w.reply->init((uint64_t) size) ;
+    r_workers.push_back(w) ;
+    if(!ok)
+      r_pool_fail("r_init: process-shared semaphores not supported") ;
+
+    std::string expr = "dyn.load('" + lib + "') ; invisible(.Call('rolog_worker_', '" + w.name + "'))" ;
+    char* argv[] = { (char*) rscript.c_str(), (char*) "-e", (char*) expr.c_str(), NULL } ;
+    if(posix_spawn(&r_workers.back().pid, rscript.c_str(), NULL, NULL, argv, environ) != 0)
+    {
+      r_workers.back().pid = 0 ;
+      r_pool_fail("r_init: cannot start R worker") ;
+    }
   }
 
-  catch(const Rcpp::eval_error& ex)
+  // Wait until the workers have attached to the shared memory
+  for(size_t i=0 ; i<r_workers.size() ; i++)
   {
-    PlCompound syntax("evaluation_error", PlTermv(A1)) ;
-    PlCompound context("context", PlTermv(PlTerm_string("foreign r_eval_/2"), PlTerm_string(ex.what()))) ;
-    throw PlException(PlCompound("error", PlTermv(syntax, context))) ;
+    RlWorker& w = r_workers[i] ;
+    if(!w.reply->receive(w.status, w.msg, w.pid))
+    {
+      w.dead = true ;
+      r_pool_fail("r_init: R worker did not start") ;
+    }
+
+    shm_unlink(w.name.c_str()) ;
   }
 
-  catch(const std::exception& ex)
+  return true ;
+}
+
+PREDICATE(r_pool_size_, 1)
+{
+  return A1.unify_integer((int) r_workers.size()) ;
+}
+
+// Wait for an idle worker and reserve it
+PREDICATE(r_pool_acquire_, 1)
+{
+  std::unique_lock<std::mutex> lock(r_pool_mutex) ;
+  while(true)
   {
-    PlCompound syntax("evaluation_error", PlTermv(A1)) ;
-    PlCompound context("context", PlTermv(PlTerm_string("foreign r_eval_/2"), PlTerm_string(ex.what()))) ;
-    throw PlException(PlCompound("error", PlTermv(syntax, context))) ;
+    bool alive = false ;
+    for(size_t i=0 ; i<r_workers.size() ; i++)
+    {
+      if(r_workers[i].dead)
+        continue ;
+
+      alive = true ;
+      if(!r_workers[i].busy)
+      {
+        r_workers[i].busy = true ;
+        return A1.unify_integer((int) i) ;
+      }
+    }
+
+    if(!alive)
+      throw PlException(PlTerm_string("r_pool_eval: no R workers left")) ;
+
+    r_pool_idle.wait(lock) ;
   }
+}
 
-  catch(...)
+PREDICATE(r_pool_release_, 1)
+{
+  RlWorker& w = r_worker_arg(A1) ;
   {
-    throw PlException(PlTerm_string("unknown exception")) ;
-    return false ;
+    std::lock_guard<std::mutex> lock(r_pool_mutex) ;
+    w.busy = false ;
   }
 
-  try
+  r_pool_idle.notify_one() ;
+  return true ;
+}
+
+// Translate and serialize the expression. This needs the mutex rolog.
+PREDICATE(r_pool_send_, 2)
+{
+  RlWorker& w = r_worker_arg(A1) ;
+  CharacterVector names ;
+  PlTerm_var vars ;
+  RObject expr = pl2r(A2, names, vars, eval_options(r_eval_options())) ;
+  if(!r_serialize(expr, w.msg))
+    throw PlException(PlTerm_string("r_pool_eval: cannot serialize expression")) ;
+
+  return true ;
+}
+
+// Send the expression and wait for the result of the worker. This does not
+// need the mutex. The worker is marked as dead if it is gone.
+PREDICATE(r_pool_wait_, 1)
+{
+  RlWorker& w = r_worker_arg(A1) ;
+  RlEvalTimer t ;
+  if(!w.request->send(0, w.msg, w.pid) || !w.reply->receive(w.status, w.msg, w.pid))
   {
-    if(!A2.unify_term(r2pl(Res, names, vars, options)))
     {
-      throw PlException(PlTerm_string("r_eval/2: Cannot unify R object.")) ;
-      return false ;
+      std::lock_guard<std::mutex> lock(r_pool_mutex) ;
+      w.dead = true ;
     }
-  }
 
-  catch(std::exception& ex)
-  {
-    throw PlException(PlTerm_string(ex.what())) ;
-    return false ;
+    // Waiters in r_pool_acquire_ check if any workers are left
+    r_pool_idle.notify_all() ;
+    throw PlException(PlTerm_string("r_pool_eval: R worker died")) ;
   }
 
-  catch(...)
+  return true ;
+}
+
+// Translate the result to prolog. This needs the mutex rolog.
+PREDICATE(r_pool_receive_, 3)
+{
+  RlWorker& w = r_worker_arg(A1) ;
+  if(w.status)
   {
-    throw PlException(PlTerm_string("unknown exception1")) ;
-    return false ;
+    std::string err(w.msg.begin(), w.msg.end()) ;
+    PlCompound syntax("evaluation_error", PlTermv(A2)) ;
+    PlCompound context("context", PlTermv(PlTerm_string("foreign r_pool_eval/2"), PlTerm_string(err.c_str()))) ;
+    throw PlException(PlCompound("error", PlTermv(syntax, context))) ;
   }
 
+  SEXP x ;
+  if(!r_unserialize(w.msg, x))
+    throw PlException(PlTerm_string("r_pool_eval: cannot unserialize result")) ;
+
+  // Protected by RObject, so that it is released if r2pl throws
+  RObject res(x) ;
+  R_ReleaseObject(x) ;
+
+  CharacterVector names ;
+  PlTerm_var vars ;
+  PlTerm pl = r2pl(res, names, vars, r_eval_options()) ;
+  return A3.unify_term(pl) ;
+}
+
+// Stop the workers, see at_halt in r_init/1
+PREDICATE(r_pool_done_, 0)
+{
+  r_pool_stop() ;
   return true ;
 }
 
+#else // _WIN32
+
+PREDICATE(r_pool_init_, 4)
+{
+  throw PlException(PlTerm_string("r_init: R workers are not available on Windows")) ;
+  return false ;
+}
+
+PREDICATE(r_pool_size_, 1)
+{
+  return A1.unify_integer(0) ;
+}
+
+#endif // _WIN32
+
 #endif // PROLOGPACK
@@ -0,0 +1,92 @@
+:- module(test_load, [test_load/0]).
+
+:- use_module(library(plunit)).
+:- use_module(library(lists)).
+:- use_module(library(apply)).
+
+% Load the library from our pack that needs to be tested
+:- use_module(library(rolog)).
+
+% Load test: ROLOG_LOAD_THREADS threads (default 4) call R concurrently, each
+% ROLOG_LOAD_CALLS times (default 100). For each payload, the test reports 
+% throughput, median and 99th percentile latency and the time spent waiting 
+% on the rolog mutex.
+%
+% Since the rolog mutex is recursive, the calls are wrapped in with_mutex/2, 
+% so that the time until the mutex is acquired can be measured.
+
+test_load :-
+    run_tests([load]).
+
+env_number(Name, Default, Value) :-
+    (   getenv(Name, Atom),
+        atom_number(Atom, Value)
+    ->  true
+    ;   Value = Default
+    ).
+
+load(Name, Goal) :-
+    env_number('ROLOG_LOAD_THREADS', 4, Threads),
+    env_number('ROLOG_LOAD_CALLS', 100, Calls),
+    message_queue_create(Queue),
+    get_time(T0),
+    findall(Id,
+        (   between(1, Threads, _),
+            thread_create(worker(Queue, Goal, Calls), Id, [])
+        ), Ids),
+    maplist(thread_join, Ids),
+    get_time(T1),
+    findall(Wait-Latency, 
+        thread_get_message(Queue, Wait-Latency, [timeout(0)]), Timings),
+    message_queue_destroy(Queue),
+    report(Name, Threads, Calls, T1 - T0, Timings).
+
+worker(Queue, Goal, Calls) :-
+    forall(between(1, Calls, _),
+        (   get_time(T0),
+            with_mutex(rolog, (get_time(T1), once(Goal))),
+            get_time(T2),
+            Wait is T1 - T0,
+            Latency is T2 - T0,
+            thread_send_message(Queue, Wait-Latency)
+        )).
+
+report(Name, Threads, Calls, Elapsed, Timings) :-
+    pairs_keys_values(Timings, Waits, Latencies),
+    length(Latencies, N),
+    assertion(N =:= Threads * Calls),
+    Throughput is N / Elapsed,
+    percentile(Latencies, 0.5, P50),
+    percentile(Latencies, 0.99, P99),
+    sum_list(Waits, Wait),
+    sum_list(Latencies, Busy),
+    WaitMs is 1000 * Wait / N,
+    WaitPct is 100 * Wait / Busy,
+    format(user_output,
+      "load ~w: ~d threads x ~d calls, ~1f calls/s, p50 ~3f ms, p99 ~3f ms, mutex wait ~3f ms/call (~1f%)~n",
+      [Name, Threads, Calls, Throughput, 1000 * P50, 1000 * P99, WaitMs, WaitPct]).
+
+percentile(Xs, P, X) :-
+    msort(Xs, Sorted),
+    length(Sorted, N),
+    I is floor(P * (N - 1)),
+    nth0(I, Sorted, X).
+
+:- begin_tests(load).
+
+test(scalar) :-
+    load(scalar, (r_eval(1 + 1, Res), Res =:= 2)).
+
+test(vector) :-
+    numlist(1, 1000, L),
+    compound_name_arguments(V, ##, L),
+    load(vector, (r_eval(sum(V), Res), Res =:= 500500)).
+
+test(matrix) :-
+    load(matrix, (r_eval(matrix(0.5, nrow=500, ncol=500), Res),
+      compound_name_arity(Res, ###, 500))).
+
+test(call) :-
+    load(call, r_call(identity(1))).
+
+:- end_tests(load).
@@ -7,7 +7,8 @@
 :- use_module(library(rolog)).
 
 test_rolog :-
-    run_tests([basic, assignment, vector, indexing, empty]).
+    run_tests([basic, assignment, vector, indexing, empty, stream, vec, trace, pool,
+               transfer]).
 
 :- begin_tests(basic).
 
@@ -19,6 +20,22 @@ test(comparison1) :-
     r_eval(2 =< 3, Res),
     assertion(Res =@= true).
 
+test(namespace) :-
+    r_eval(base::sum(1, 2, 3), Res),
+    assertion(Res =@= 6).
+
+test(curly) :-
+    r_eval({x <- 2 ; x + 1}, Res),
+    assertion(Res =@= 3).
+
+test(codec_call) :-
+    r_eval(nrow('data.frame'(x=##(1, 2), y=##(3, 4))), Res),
+    assertion(Res =@= 2).
+
+test(codec_result) :-
+    r_eval('data.frame'(x=##(1, 2), y=##(3, 4)), Res),
+    assertion(Res = '$r'('data.frame', _, _)).
+
 :- end_tests(basic).
 
 :- begin_tests(assignment).
@@ -74,3 +91,98 @@ test(empty_brackets) :-
     assertion(Res =@= []).
 
 :- end_tests(empty).
+
+:- begin_tests(stream).
+
+test(stream) :-
+    r_stream(1:25000, List, [chunk(1000)]),
+    sum_list(List, Sum),
+    assertion(Sum =:= 312512500).
+
+test(stream_empty) :-
+    r_stream(integer(0), List),
+    assertion(List == []).
+
+:- end_tests(stream).
+
+:- begin_tests(vec).
+
+test(vec_sum) :-
+    r_vec(sum, '##'(1.5, 2.5, 4.0), S),
+    assertion(S =:= 8.0).
+
+test(vec_na) :-
+    r_vec(mean, '##'(1.0, na), M),
+    assertion(M == na).
+
+test(vec_arith) :-
+    r_vec(+, '%%'(1, 2, 3), 1, X),
+    assertion(X == '%%'(2, 3, 4)).
+
+test(vec_which_max) :-
+    r_vec(which_max, '##'(na, 3.0, 1.0, 3.0), I),
+    assertion(I == 2).
+
+:- end_tests(vec).
+
+:- begin_tests(trace).
+
+test(trace) :-
+    rolog_trace(on),
+    r_eval(1 + 1, _),
+    rolog_trace(off),
+    tmp_file_stream(text, File, Stream),
+    close(Stream),
+    rolog_trace_write(File),
+    read_file_to_string(File, String, []),
+    delete_file(File),
+    assertion(sub_string(String, _, _, _, "\"name\":\"mutex\"")),
+    assertion(sub_string(String, _, _, _, "\"name\":\"eval\"")).
+
+:- end_tests(trace).
+
+:- begin_tests(pool, [condition(\+ current_prolog_flag(windows, true))]).
+
+test(pool) :-
+    r_init([workers(2)]),
+    r_pool_eval(sum(1:10), Res),
+    assertion(Res =@= 55).
+
+test(pool_error, [throws(error(evaluation_error(_), _))]) :-
+    r_pool_eval(stop("error in worker"), _).
+
+% r_eval/2 and <- stay with the embedded R, the workers do not see its state
+test(pool_state) :-
+    r_call(w <- 41),
+    r_eval(w + 1, Res),
+    assertion(Res =@= 42).
+
+test(pool_fresh, [throws(error(evaluation_error(_), _))]) :-
+    r_pool_eval(w, _).
+
+test(pool_parallel) :-
+    numlist(1, 4, L),
+    concurrent_maplist([X, Y]>>r_pool_eval(X * 2, Y), L, Ys),
+    assertion(Ys =@= [2, 4, 6, 8]).
+
+:- end_tests(pool).
+
+:- begin_tests(transfer).
+
+test(transfer_list) :-
+    E = list(a=1, b=list("x", ##(1.5, 2.5)), c=quote(f(x, y=2)), d=true),
+    r_eval(E, Fast, [transfer(fast)]),
+    r_eval(E, Res),
+    assertion(Fast =@= Res).
+
+test(transfer_nested) :-
+    numlist(1, 200, L),
+    foldl([X, T0, f(X, [T0, "s"])]>>true, L, a, T),
+    r_eval(quote(T), Fast, [transfer(fast)]),
+    r_eval(quote(T), Res),
+    assertion(Fast =@= Res).
+
+test(transfer_option, [throws(error(domain_error(_, slow), _))]) :-
+    r_eval(1, _, [transfer(slow)]).
+
+:- end_tests(transfer).
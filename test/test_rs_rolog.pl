@@ -0,0 +1,68 @@
+:- module(test_rs_rolog, [test_rs_rolog/0]).
+
+:- use_module(library(plunit)).
+:- use_module(library(broadcast)).
+
+% Load the library from our pack that needs to be tested
+:- use_module(library(rs_rolog)).
+
+% The tests need the R package RSclient and an Rserve server on localhost,
+% otherwise they are skipped.
+
+test_rs_rolog :-
+    run_tests([rs_rolog]).
+
+rserve :-
+    catch(rs_init(rs_test), _, fail).
+
+:- begin_tests(rs_rolog, [condition(rserve), cleanup(rs_close(rs_test))]).
+
+test(queue) :-
+    message_queue_create(Queue),
+    listen(test_rs_rolog, rs_result(rs_test, Alias, _, Value),
+      thread_send_message(Queue, Alias-Value)),
+    rs_submit(rs_test, a, 'Sys.sleep'(0.5)),
+    rs_submit(rs_test, b, 1 + 1),
+    rs_submit(rs_test, c, 2 + 2),
+    rs_load(rs_test, Load),
+    findall(A-V, (between(1, 3, _), thread_get_message(Queue, A-V, [timeout(30)])), Results),
+    unlisten(test_rs_rolog),
+    message_queue_destroy(Queue),
+    assertion(Load =:= 3),
+    assertion(Results = [a-_, b-2, c-4]).
+
+test(mutex) :-
+    rs_submit(rs_test, sleep, 'Sys.sleep'(2)),
+    get_time(T0),
+    r_eval(1 + 1, Res),
+    get_time(T1),
+    rs_eval(rs_test, 3 + 3, Res2),
+    assertion(Res =:= 2),
+    assertion(T1 - T0 < 1),
+    assertion(Res2 =:= 6).
+
+test(close) :-
+    rs_init(rs_close),
+    message_queue_create(Queue),
+    listen(test_rs_rolog, rs_result(rs_close, Alias, _, _),
+      thread_send_message(Queue, Alias)),
+    rs_submit(rs_close, a, 'Sys.sleep'(0.5)),
+    rs_submit(rs_close, b, 1 + 1),
+    rs_close(rs_close),
+    findall(A, (between(1, 2, _), thread_get_message(Queue, A, [timeout(30)])), Aliases),
+    unlisten(test_rs_rolog),
+    message_queue_destroy(Queue),
+    assertion(Aliases == [a, b]).
+
+test(rx_submit) :-
+    message_queue_create(Queue),
+    listen(test_rs_rolog, rs_result(Session, rx, _, Value),
+      thread_send_message(Queue, Session-Value)),
+    rx_submit(rx, 5 * 5),
+    thread_get_message(Queue, Session-Value, [timeout(30)]),
+    unlisten(test_rs_rolog),
+    message_queue_destroy(Queue),
+    assertion(Session == rs_test),
+    assertion(Value =:= 25).
+
+:- end_tests(rs_rolog).